@@ -6,8 +6,27 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <ftw.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <sys/un.h>
+#include <climits>
+#include <limits>
+#include <pwd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <sstream>
@@ -18,22 +37,254 @@
 #include <iomanip>
 #include <iostream>
 #include <cctype>
+#include <deque>
+#include <memory>
+#include <cstdarg>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <ctime>
+#include <charconv>
+
+struct ProcKey {
+    int pid{0};
+    unsigned long long starttime{0};
+    bool operator<(const ProcKey &o) const { return pid != o.pid ? pid < o.pid : starttime < o.starttime; }
+    bool operator==(const ProcKey &o) const { return pid == o.pid && starttime == o.starttime; }
+};
+
+struct ProcKeyHash {
+    size_t operator()(const ProcKey &k) const {
+        return std::hash<unsigned long long>()(((unsigned long long)k.pid << 40) ^ k.starttime);
+    }
+};
+
+static const uint32_t NO_SLOT = UINT32_MAX;
 
 struct ProcInfo {
     int pid{0};
+    int ppid{0};
+    uint32_t slot{NO_SLOT};
+    uint32_t generation{0};
     std::string user;
     std::string cmd;
+    std::string cgroup;
     unsigned long utime{0}, stime{0}, cutime{0}, cstime{0};
     unsigned long long total_time{0};
     unsigned long vsize{0};
     long rss{0};
+    long peak_rss{0};  // pages, highest rss seen since the process was first sampled
     double cpu_percent{0.0};
     double mem_percent{0.0};
+    double child_cpu_percent{0.0};
+    unsigned long minflt{0}, majflt{0};
+    unsigned long long io_read_bytes{0}, io_write_bytes{0};
+    double io_kb_per_s{0.0};
+    double faults_per_s{0.0};
+    double cpu_avg[3]{0.0, 0.0, 0.0};
+    float anomaly{0.0f};     // largest deviation from the process's own baseline, in std devs
+    char anomaly_metric{' '};
     unsigned long long starttime{0};
+    int processor{-1};  // CPU it last ran on (stat field 39)
+    float ipc{-1.0f}, mpki{-1.0f}, csw_per_s{-1.0f};  // from perf counters; -1 when not counted
+    float oncpu_percent{-1.0f};  // task-clock time on CPU, counted when IPC is not
+    bool stale{false};  // not re-read this tick (over the scan budget or a failed read); values are the last good ones
+    unsigned long long read_jiffies{0};  // system total_jiffies when the counters were read; 0 if unknown
+    ProcKey key() const { return ProcKey{pid, starttime}; }
+};
+
+using ProcMap = std::map<ProcKey, ProcInfo>;
+
+// Stable per-process slots keyed by (pid, starttime). A slot's generation is
+// bumped every time it is handed to a new process, so a (slot, generation)
+// pair held by a cache or history can never be mistaken for a later process
+// that reuses the slot or the pid. Exited processes keep their slot (and so
+// their history) until the table is full, then the least recently exited one
+// is evicted.
+class ProcTable {
+public:
+    explicit ProcTable(size_t max_slots = 32768) : max_slots_(max_slots) {}
+
+    // Returns true when p got a fresh slot whose per-slot state must be reset.
+    bool assign(ProcInfo &p, unsigned long long tick) {
+        ProcKey k = p.key();
+        uint32_t idx;
+        bool fresh = false;
+        auto it = index_.find(k);
+        if (it != index_.end()) {
+            idx = it->second;
+        } else {
+            if (slots_.size() < max_slots_) {
+                idx = (uint32_t)slots_.size();
+                slots_.emplace_back();
+            } else {
+                idx = evict();
+                if (idx == NO_SLOT) {
+                    p.slot = NO_SLOT;
+                    return false;
+                }
+            }
+            slots_[idx].key = k;
+            slots_[idx].live = true;
+            index_[k] = idx;
+            fresh = true;
+        }
+        slots_[idx].last_seen = tick;
+        p.slot = idx;
+        p.generation = slots_[idx].generation;
+        return fresh;
+    }
+
+    // Marks every live slot not seen in the given tick as exited.
+    void sweep(unsigned long long tick) {
+        for (uint32_t i = 0; i < slots_.size(); ++i) {
+            Slot &sl = slots_[i];
+            if (!sl.live || sl.last_seen == tick) continue;
+            sl.live = false;
+            dead_.push_back(i);
+        }
+    }
+
+    // True while the slot still holds the process the handle was issued for.
+    bool valid(uint32_t slot, uint32_t generation) const {
+        return slot < slots_.size() && slots_[slot].generation == generation;
+    }
+
+    bool live(uint32_t slot) const { return slot < slots_.size() && slots_[slot].live; }
+    const ProcKey &key(uint32_t slot) const { return slots_[slot].key; }
+    size_t capacity() const { return slots_.size(); }
+    size_t max_slots() const { return max_slots_; }
+    size_t live_count() const { return slots_.size() - dead_.size(); }
+
+private:
+    struct Slot {
+        ProcKey key;
+        uint32_t generation{0};
+        bool live{false};
+        unsigned long long last_seen{0};
+    };
+
+    uint32_t evict() {
+        if (dead_.empty()) return NO_SLOT;
+        uint32_t idx = dead_.front();
+        dead_.pop_front();
+        index_.erase(slots_[idx].key);
+        slots_[idx].generation++;
+        return idx;
+    }
+
+    size_t max_slots_;
+    std::vector<Slot> slots_;
+    std::deque<uint32_t> dead_;
+    std::unordered_map<ProcKey, uint32_t, ProcKeyHash> index_;
+};
+
+// Last N samples per process slot, one ring buffer column per metric so a
+// metric can be scanned without touching the others. Memory is bounded by
+// max_slots * depth * NUM_METRICS floats.
+class MetricHistory {
+public:
+    enum Metric { CPU, RSS_KB, IO_KBS, FAULTS, NUM_METRICS };
+
+    explicit MetricHistory(size_t depth = 60) : depth_(depth) {}
+
+    size_t depth() const { return depth_; }
+
+    void reset(uint32_t slot) {
+        ensure(slot);
+        head_[slot] = 0;
+        count_[slot] = 0;
+    }
+
+    void push(uint32_t slot, const float (&vals)[NUM_METRICS]) {
+        ensure(slot);
+        size_t base = (size_t)slot * depth_ + head_[slot];
+        for (int m = 0; m < NUM_METRICS; ++m) cols_[m][base] = vals[m];
+        head_[slot] = (uint32_t)((head_[slot] + 1) % depth_);
+        if (count_[slot] < depth_) count_[slot]++;
+    }
+
+    // Number of samples held for the slot.
+    size_t count(uint32_t slot) const { return slot < count_.size() ? count_[slot] : 0; }
+
+    // Copies up to n most recent samples, oldest first. Returns the count copied.
+    size_t read(uint32_t slot, Metric m, float *out, size_t n) const {
+        if (slot >= count_.size()) return 0;
+        size_t have = std::min<size_t>(n, count_[slot]);
+        size_t start = (head_[slot] + depth_ - have) % depth_;
+        const float *col = &cols_[m][(size_t)slot * depth_];
+        for (size_t i = 0; i < have; ++i) out[i] = col[(start + i) % depth_];
+        return have;
+    }
+
+private:
+    void ensure(uint32_t slot) {
+        if (slot < head_.size()) return;
+        size_t n = (size_t)slot + 1;
+        for (int m = 0; m < NUM_METRICS; ++m) cols_[m].resize(n * depth_, 0.0f);
+        head_.resize(n, 0);
+        count_.resize(n, 0);
+    }
+
+    size_t depth_;
+    std::vector<float> cols_[NUM_METRICS];
+    std::vector<uint32_t> head_;
+    std::vector<uint32_t> count_;
+};
+
+// Load-average style exponentially weighted CPU% per slot for several time
+// constants. Each update is O(1) per process and uses the real interval
+// length, so the averages stay comparable when the refresh rate changes.
+class CpuEwma {
+public:
+    static const int NUM_WINDOWS = 3;
+    static constexpr double windows_s[NUM_WINDOWS] = {1.0, 10.0, 60.0};
+
+    void reset(uint32_t slot) {
+        ensure(slot);
+        primed_[slot] = 0;
+    }
+
+    void update(uint32_t slot, double cpu, double dt_s, double (&out)[NUM_WINDOWS]) {
+        ensure(slot);
+        for (int w = 0; w < NUM_WINDOWS; ++w) {
+            double &v = avg_[w][slot];
+            if (!primed_[slot]) v = cpu;
+            else v += (1.0 - std::exp(-dt_s / windows_s[w])) * (cpu - v);
+            out[w] = v;
+        }
+        primed_[slot] = 1;
+    }
+
+    // Continues from averages computed earlier (e.g. by a previous run).
+    void restore(uint32_t slot, const double (&avg)[NUM_WINDOWS]) {
+        ensure(slot);
+        for (int w = 0; w < NUM_WINDOWS; ++w) avg_[w][slot] = avg[w];
+        primed_[slot] = 1;
+    }
+
+private:
+    void ensure(uint32_t slot) {
+        if (slot < primed_.size()) return;
+        for (int w = 0; w < NUM_WINDOWS; ++w) avg_[w].resize((size_t)slot + 1, 0.0);
+        primed_.resize((size_t)slot + 1, 0);
+    }
+
+    std::vector<double> avg_[NUM_WINDOWS];
+    std::vector<unsigned char> primed_;
 };
+constexpr double CpuEwma::windows_s[CpuEwma::NUM_WINDOWS];
 
 struct SystemSnapshot {
     unsigned long long total_jiffies{0};
+    unsigned long long idle_jiffies{0};
+    unsigned long long task_jiffies{0};   // user+nice+system: what processes can be charged with
+    unsigned long long irq_jiffies{0};    // irq+softirq
+    unsigned long long steal_jiffies{0};
     unsigned long mem_total_kb{0};
     unsigned long mem_free_kb{0};
     unsigned long mem_available_kb{0};
@@ -51,32 +302,79 @@ static inline std::vector<std::string> split(const std::string &s, char delim='
     return out;
 }
 
-unsigned long long read_total_jiffies() {
-    std::ifstream f("/proc/stat");
+// Parses a kernel CPU or node list such as "0-3,8,10-11".
+static std::vector<int> parse_cpu_list(const std::string &s) {
+    std::vector<int> out;
+    for (const std::string &part : split(s, ',')) {
+        int a = 0, b = 0;
+        int n = sscanf(part.c_str(), "%d-%d", &a, &b);
+        if (n == 1) b = a;
+        if (n < 1 || b < a || b - a > 65536) continue;
+        for (int c = a; c <= b; ++c) out.push_back(c);
+    }
+    return out;
+}
+
+// Where the collector reads system and per-process files; --proc-root points
+// it at a copy or a synthetic tree.
+static std::string g_proc_root = "/proc";
+
+// The aggregate cpu line of /proc/stat: user nice system idle iowait irq
+// softirq steal guest guest_nice. Guest time is already part of user and
+// nice (and of the vCPU threads' utime), so it is not added again.
+static void read_cpu_jiffies(SystemSnapshot &s) {
+    std::ifstream f(g_proc_root + "/stat");
     std::string line;
-    if (!std::getline(f, line)) return 0;
+    if (!std::getline(f, line)) return;
     std::stringstream ss(line);
     std::string cpu;
     ss >> cpu;
-    unsigned long long val, total = 0;
-    while (ss >> val) total += val;
-    return total;
+    unsigned long long v[8] = {};
+    for (int i = 0; i < 8 && ss >> v[i]; ++i) {}
+    s.total_jiffies = 0;
+    for (unsigned long long x : v) s.total_jiffies += x;
+    s.idle_jiffies = v[3] + v[4];
+    s.task_jiffies = v[0] + v[1] + v[2];
+    s.irq_jiffies = v[5] + v[6];
+    s.steal_jiffies = v[7];
+}
+
+// Boot time in epoch seconds (the btime line of /proc/stat), 0 if unknown.
+static uint64_t read_boot_time() {
+    std::ifstream f(g_proc_root + "/stat");
+    std::string key;
+    while (f >> key) {
+        if (key == "btime") {
+            uint64_t t = 0;
+            f >> t;
+            return t;
+        }
+        f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+double snapshot_interval_s(const SystemSnapshot &cur, const SystemSnapshot &prev) {
+    static long clk_tck = sysconf(_SC_CLK_TCK);
+    if (cur.total_jiffies <= prev.total_jiffies) return 0.0;
+    return (double)(cur.total_jiffies - prev.total_jiffies) / (double)cur.num_cpus / (double)clk_tck;
 }
 
 SystemSnapshot read_system_snapshot() {
     SystemSnapshot s;
-    s.total_jiffies = read_total_jiffies();
+    read_cpu_jiffies(s);
 
-    std::ifstream memf("/proc/meminfo");
+    std::ifstream memf(g_proc_root + "/meminfo");
     std::string key;
     unsigned long val;
     while (memf >> key >> val) {
         if (key == "MemTotal:") s.mem_total_kb = val;
         else if (key == "MemFree:") s.mem_free_kb = val;
         else if (key == "MemAvailable:") s.mem_available_kb = val;
+        memf.ignore(64, '\n');
     }
 
-    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::ifstream cpuinfo(g_proc_root + "/cpuinfo");
     std::string line;
     int cpus = 0;
     while (std::getline(cpuinfo, line)) {
@@ -87,13 +385,48 @@ SystemSnapshot read_system_snapshot() {
     return s;
 }
 
+void read_proc_io(int pid, unsigned long long &read_bytes, unsigned long long &write_bytes) {
+    std::ifstream f(g_proc_root + "/" + std::to_string(pid) + "/io");
+    std::string key;
+    unsigned long long val;
+    while (f >> key >> val) {
+        if (key == "read_bytes:") read_bytes = val;
+        else if (key == "write_bytes:") write_bytes = val;
+    }
+}
+
+std::string user_name(uid_t uid) {
+    static std::unordered_map<uid_t, std::string> cache;
+    static std::mutex mu;  // shared by the parallel collector's threads
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = cache.find(uid);
+    if (it != cache.end()) return it->second;
+    struct passwd pw, *res = nullptr;
+    char buf[1024];
+    std::string name = getpwuid_r(uid, &pw, buf, sizeof(buf), &res) == 0 && res ? pw.pw_name : std::to_string(uid);
+    cache[uid] = name;
+    return name;
+}
+
+std::string read_cgroup(int pid) {
+    std::ifstream f(g_proc_root + "/" + std::to_string(pid) + "/cgroup");
+    std::string line, path;
+    // cgroup v2 is the "0::" line; otherwise fall back to the first hierarchy.
+    while (std::getline(f, line)) {
+        size_t c2 = line.find(':', line.find(':') + 1);
+        if (c2 == std::string::npos) continue;
+        if (path.empty() || line.rfind("0::", 0) == 0) path = line.substr(c2 + 1);
+    }
+    return path;
+}
+
 std::string read_cmdline(int pid) {
-    std::string path = "/proc/" + std::to_string(pid) + "/cmdline";
+    std::string path = g_proc_root + "/" + std::to_string(pid) + "/cmdline";
     std::ifstream f(path);
     std::string s;
     std::getline(f, s, '\0');
     if (s.empty()) {
-        std::ifstream g("/proc/" + std::to_string(pid) + "/comm");
+        std::ifstream g(g_proc_root + "/" + std::to_string(pid) + "/comm");
         std::getline(g, s);
         return s;
     }
@@ -101,84 +434,288 @@ std::string read_cmdline(int pid) {
     return s;
 }
 
-std::map<int, ProcInfo> read_all_procs() {
-    std::map<int, ProcInfo> procs;
-    DIR *d = opendir("/proc");
+// Limits for one scan. When more than max_parse processes are listed, the
+// ones busiest in prev plus a window that rotates across calls are parsed and
+// the rest are carried over from prev (marked stale), so a fork bomb cannot
+// stretch a tick without bound and every process is still revisited.
+struct ScanBudget {
+    size_t max_parse{SIZE_MAX};
+    const ProcMap *prev{nullptr};
+};
+
+struct ScanStats {
+    size_t listed{0};
+    size_t parsed{0};
+    size_t carried{0};
+    size_t failed{0};  // reads that failed with EAGAIN/ENOMEM/EINTR rather than because the process exited
+};
+
+// cmdline and cgroup are only re-read when the (pid, starttime) is new or
+// comm changed (exec).
+struct CmdEntry { std::string comm, cmd, cgroup; };
+typedef std::unordered_map<ProcKey, CmdEntry, ProcKeyHash> CmdCache;
+
+enum ParseResult { PARSE_OK, PARSE_GONE, PARSE_TRANSIENT };
+
+// Reads one process. The cache is only read, so any number of threads may
+// call this at once; the caller collects `entry` into the next cache.
+static ParseResult parse_proc(int pid, const CmdCache &cache, ProcInfo &p, CmdEntry &entry) {
+    std::string statp = g_proc_root + "/" + std::to_string(pid) + "/stat";
+    errno = 0;
+    std::ifstream f(statp);
+    std::string statline;
+    if (!f || !std::getline(f, statline))
+        return errno == EAGAIN || errno == ENOMEM || errno == EINTR ? PARSE_TRANSIENT : PARSE_GONE;
+    auto p1 = statline.find('(');
+    auto p2 = statline.rfind(')');
+    if (p1==std::string::npos || p2==std::string::npos) return PARSE_GONE;
+    std::string comm = statline.substr(p1+1, p2-p1-1);
+
+    std::ifstream f2(statp);
+    if (!f2) return PARSE_GONE;
+    std::string full;
+    std::getline(f2, full);
+    size_t rp = full.rfind(')');
+    if (rp == std::string::npos) return PARSE_GONE;
+    std::string after = full.substr(rp+2);
+    auto toks = split(after, ' ');
+    unsigned long utime=0, stime=0, cutime=0, cstime=0;
+    unsigned long long starttime = 0;
+    unsigned long vsize = 0;
+    long rss = 0;
+    int ppid = 0;
+    int processor = -1;
+    unsigned long minflt = 0, majflt = 0;
+    if (toks.size() >= 22) {
+        try {
+            ppid = std::stoi(toks[1]);
+            minflt = std::stoul(toks[7]);
+            majflt = std::stoul(toks[9]);
+            utime = std::stoul(toks[11]);
+            stime = std::stoul(toks[12]);
+            cutime = std::stoul(toks[13]);
+            cstime = std::stoul(toks[14]);
+            starttime = std::stoull(toks[19]);
+            vsize = std::stoul(toks[20]);
+            rss = std::stol(toks[21]);
+            if (toks.size() >= 37) processor = std::stoi(toks[36]);
+        } catch(...) {}
+    }
+
+    struct stat st;
+    if (stat((g_proc_root + "/" + std::to_string(pid)).c_str(), &st) == 0) p.user = user_name(st.st_uid);
+    p.pid = pid;
+    p.ppid = ppid;
+    ProcKey k{pid, starttime};
+    auto ct = cache.find(k);
+    if (ct != cache.end() && ct->second.comm == comm) {
+        p.cmd = ct->second.cmd;
+        p.cgroup = ct->second.cgroup;
+    } else {
+        p.cmd = read_cmdline(pid);
+        p.cgroup = read_cgroup(pid);
+    }
+    entry = CmdEntry{comm, p.cmd, p.cgroup};
+    p.utime = utime; p.stime = stime; p.cutime = cutime; p.cstime = cstime;
+    p.total_time = (unsigned long long)utime + stime + cutime + cstime;
+    p.starttime = starttime;
+    p.vsize = vsize;
+    p.rss = rss;
+    p.processor = processor;
+    p.minflt = minflt;
+    p.majflt = majflt;
+    read_proc_io(pid, p.io_read_bytes, p.io_write_bytes);
+    return PARSE_OK;
+}
+
+// threads > 1 splits the parse across that many threads (falling back to
+// fewer if they cannot be created); the result is the same as a serial scan.
+ProcMap read_all_procs(const ScanBudget &budget = ScanBudget(), ScanStats *stats = nullptr, unsigned threads = 1) {
+    static CmdCache cmd_cache;
+    static size_t rotate = 0;
+    CmdCache next_cache;
+    ScanStats local;
+    ScanStats &st_out = stats ? *stats : local;
+    st_out = ScanStats();
+    ProcMap procs;
+    DIR *d = opendir(g_proc_root.c_str());
     if (!d) return procs;
+    std::vector<int> pids;
     struct dirent *de;
     while ((de = readdir(d))) {
-        if (!isdigit(de->d_name[0])) continue;
-        int pid = atoi(de->d_name);
-        std::string statp = "/proc/" + std::to_string(pid) + "/stat";
-        std::ifstream f(statp);
-        if (!f) continue;
-        std::string statline;
-        std::getline(f, statline);
-        auto p1 = statline.find('(');
-        auto p2 = statline.rfind(')');
-        if (p1==std::string::npos || p2==std::string::npos) continue;
-        std::string comm = statline.substr(p1+1, p2-p1-1);
-
-        std::ifstream f2(statp);
-        if (!f2) continue;
-        std::string full;
-        std::getline(f2, full);
-        size_t rp = full.rfind(')');
-        if (rp == std::string::npos) continue;
-        std::string after = full.substr(rp+2);
-        auto toks = split(after, ' ');
-        unsigned long utime=0, stime=0, cutime=0, cstime=0;
-        unsigned long long starttime = 0;
-        unsigned long vsize = 0;
-        long rss = 0;
-        if (toks.size() >= 22) {
-            try {
-                utime = std::stoul(toks[11]);
-                stime = std::stoul(toks[12]);
-                cutime = std::stoul(toks[13]);
-                cstime = std::stoul(toks[14]);
-                starttime = std::stoull(toks[19]);
-                vsize = std::stoul(toks[20]);
-                rss = std::stol(toks[21]);
-            } catch(...) {}
+        if (isdigit(de->d_name[0])) pids.push_back(atoi(de->d_name));
+    }
+    closedir(d);
+    std::sort(pids.begin(), pids.end());
+    st_out.listed = pids.size();
+
+    std::vector<char> parse(pids.size(), 1);
+    if (pids.size() > budget.max_parse) {
+        std::fill(parse.begin(), parse.end(), 0);
+        size_t left = budget.max_parse;
+        if (budget.prev) {
+            std::vector<std::pair<double, int>> busy;
+            for (auto &kv : *budget.prev)
+                if (kv.second.cpu_percent > 0) busy.emplace_back(kv.second.cpu_percent, kv.first.pid);
+            size_t top = std::min(busy.size(), budget.max_parse / 4);
+            std::partial_sort(busy.begin(), busy.begin() + top, busy.end(), std::greater<std::pair<double, int>>());
+            for (size_t i = 0; i < top; ++i) {
+                auto it = std::lower_bound(pids.begin(), pids.end(), busy[i].second);
+                if (it != pids.end() && *it == busy[i].second && !parse[it - pids.begin()]) {
+                    parse[it - pids.begin()] = 1;
+                    --left;
+                }
+            }
+        }
+        for (size_t i = 0; left > 0 && i < pids.size(); ++i) {
+            size_t j = (rotate + i) % pids.size();
+            if (!parse[j]) {
+                parse[j] = 1;
+                --left;
+            }
+        }
+        rotate = (rotate + budget.max_parse) % pids.size();
+    }
+
+    // Keeps the previous entries for pid (there is normally one) instead of
+    // reporting it as exited.
+    auto carry = [&](int pid) {
+        if (!budget.prev) return;
+        for (auto it = budget.prev->lower_bound(ProcKey{pid, 0}); it != budget.prev->end() && it->first.pid == pid; ++it) {
+            ProcInfo p = it->second;
+            p.stale = true;
+            procs[it->first] = p;
+            auto ct = cmd_cache.find(it->first);
+            if (ct != cmd_cache.end()) next_cache.insert(*ct);
+            st_out.carried++;
         }
+    };
 
-        ProcInfo p;
-        p.pid = pid;
-        p.cmd = read_cmdline(pid);
-        p.utime = utime; p.stime = stime; p.cutime = cutime; p.cstime = cstime;
-        p.total_time = (unsigned long long)utime + stime + cutime + cstime;
-        p.starttime = starttime;
-        p.vsize = vsize;
-        p.rss = rss;
-        procs[pid] = p;
+    if (threads <= 1 || pids.size() < 2 * threads) {
+        for (size_t idx = 0; idx < pids.size(); ++idx) {
+            int pid = pids[idx];
+            if (!parse[idx]) {
+                carry(pid);
+                continue;
+            }
+            ProcInfo p;
+            CmdEntry entry;
+            ParseResult r = parse_proc(pid, cmd_cache, p, entry);
+            if (r == PARSE_TRANSIENT) {
+                st_out.failed++;
+                carry(pid);
+            }
+            if (r != PARSE_OK) continue;
+            st_out.parsed++;
+            next_cache[p.key()] = std::move(entry);
+            procs[p.key()] = std::move(p);
+        }
+    } else {
+        // Each thread parses a contiguous pid range into its own buffers; the
+        // ranges are merged in pid order, so the map is filled with end hints.
+        struct Part {
+            std::vector<ProcInfo> procs;
+            std::vector<CmdEntry> entries;
+            std::vector<int> carry;
+            size_t failed{0};
+        };
+        std::vector<Part> parts(threads);
+        auto work = [&](unsigned t) {
+            size_t a = pids.size() * t / threads, b = pids.size() * (t + 1) / threads;
+            Part &part = parts[t];
+            part.procs.reserve(b - a);
+            part.entries.reserve(b - a);
+            for (size_t idx = a; idx < b; ++idx) {
+                if (!parse[idx]) {
+                    part.carry.push_back(pids[idx]);
+                    continue;
+                }
+                ProcInfo p;
+                CmdEntry entry;
+                ParseResult r = parse_proc(pids[idx], cmd_cache, p, entry);
+                if (r == PARSE_TRANSIENT) {
+                    part.failed++;
+                    part.carry.push_back(pids[idx]);
+                }
+                if (r != PARSE_OK) continue;
+                part.procs.push_back(std::move(p));
+                part.entries.push_back(std::move(entry));
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; ++t) {
+            try {
+                pool.emplace_back(work, t);
+            } catch (const std::system_error &) {
+                work(t);
+            }
+        }
+        work(0);
+        for (auto &th : pool) th.join();
+        next_cache.reserve(pids.size());
+        for (auto &part : parts) {
+            for (size_t i = 0; i < part.procs.size(); ++i) {
+                ProcKey k = part.procs[i].key();
+                next_cache[k] = std::move(part.entries[i]);
+                procs.emplace_hint(procs.end(), k, std::move(part.procs[i]));
+            }
+            st_out.parsed += part.procs.size();
+            st_out.failed += part.failed;
+            for (int pid : part.carry) carry(pid);
+        }
     }
-    closedir(d);
+    cmd_cache.swap(next_cache);
     return procs;
 }
 
-void compute_cpu_mem_percent(std::map<int, ProcInfo> &procs,
-                             const std::map<int, ProcInfo> &prev,
+// System jiffies between the previous reading of a process's counters and
+// this tick. That is one interval unless the previous entry was carried
+// over under the scan budget, in which case its counters are older.
+static unsigned long long read_span(const ProcInfo &prev_entry, const SystemSnapshot &cur_snap,
+                                    const SystemSnapshot &prev_snap) {
+    unsigned long long from = prev_entry.read_jiffies ? prev_entry.read_jiffies : prev_snap.total_jiffies;
+    return cur_snap.total_jiffies > from ? cur_snap.total_jiffies - from : 0;
+}
+
+void compute_cpu_mem_percent(ProcMap &procs,
+                             const ProcMap &prev,
                              const SystemSnapshot &cur_snap,
                              const SystemSnapshot &prev_snap) {
-    unsigned long long total_diff = 0;
-    if (cur_snap.total_jiffies >= prev_snap.total_jiffies)
-        total_diff = cur_snap.total_jiffies - prev_snap.total_jiffies;
-    else total_diff = 0;
-
     static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+    static long clk_tck = sysconf(_SC_CLK_TCK);
 
     for (auto &kv : procs) {
-        int pid = kv.first;
         ProcInfo &p = kv.second;
+        if (p.stale) continue;  // keeps the rates computed when it was last read
+        p.read_jiffies = cur_snap.total_jiffies;
         p.cpu_percent = 0.0;
         p.mem_percent = 0.0;
+        p.child_cpu_percent = 0.0;
+        p.io_kb_per_s = 0.0;
+        p.faults_per_s = 0.0;
 
-        auto it = prev.find(pid);
-        if (it != prev.end() && total_diff > 0) {
-            unsigned long long prev_time = it->second.total_time;
-            unsigned long long diff = (p.total_time >= prev_time) ? (p.total_time - prev_time) : 0;
+        auto it = prev.find(kv.first);
+        unsigned long long total_diff = it != prev.end() ? read_span(it->second, cur_snap, prev_snap) : 0;
+        if (total_diff > 0) {
+            double elapsed_s = (double)total_diff / (double)cur_snap.num_cpus / (double)clk_tck;
+            // Own time only; reaped children show up separately in child_cpu_percent.
+            unsigned long long cur_own = (unsigned long long)p.utime + p.stime;
+            unsigned long long prev_own = (unsigned long long)it->second.utime + it->second.stime;
+            unsigned long long diff = (cur_own >= prev_own) ? (cur_own - prev_own) : 0;
             p.cpu_percent = (double)diff / (double)total_diff * 100.0 * cur_snap.num_cpus;
+
+            unsigned long long cur_child = (unsigned long long)p.cutime + p.cstime;
+            unsigned long long prev_child = (unsigned long long)it->second.cutime + it->second.cstime;
+            unsigned long long cdiff = (cur_child >= prev_child) ? (cur_child - prev_child) : 0;
+            p.child_cpu_percent = (double)cdiff / (double)total_diff * 100.0 * cur_snap.num_cpus;
+
+            const ProcInfo &q = it->second;
+            unsigned long long io_cur = p.io_read_bytes + p.io_write_bytes;
+            unsigned long long io_prev = q.io_read_bytes + q.io_write_bytes;
+            unsigned long long flt_cur = (unsigned long long)p.minflt + p.majflt;
+            unsigned long long flt_prev = (unsigned long long)q.minflt + q.majflt;
+            if (io_cur >= io_prev) p.io_kb_per_s = (double)(io_cur - io_prev) / 1024.0 / elapsed_s;
+            if (flt_cur >= flt_prev) p.faults_per_s = (double)(flt_cur - flt_prev) / elapsed_s;
         }
 
         long rss_pages = p.rss;
@@ -188,83 +725,5692 @@ void compute_cpu_mem_percent(std::map<int, ProcInfo> &procs,
     }
 }
 
-void draw_header(WINDOW *w, int width, const SystemSnapshot &snap) {
-    werase(w);
-    mvwprintw(w, 0, 0, " SysMon - Simple System Monitor (q:quit  s:sort CPU/MEM  k:kill PID  r:refresh time) ");
-    mvwprintw(w, 1, 0, " CPUs: %d | Total Jiffies: %llu | MemTotal: %lu KB ", snap.num_cpus, snap.total_jiffies, snap.mem_total_kb);
-    mvwprintw(w, 2, 0, " PID    CPU%%    MEM%%    RSS(KB)    CMD");
-    wrefresh(w);
+struct CpuAccounting {
+    unsigned long long busy_jiffies{0};     // user+nice+system delta
+    unsigned long long seen_jiffies{0};     // utime+stime deltas of processes in both scans
+    unsigned long long born_jiffies{0};     // utime+stime of processes that appeared this interval
+    unsigned long long reaped_jiffies{0};   // exited children charged to surviving parents
+    unsigned long long unaccounted_jiffies{0};
+    double unaccounted_percent{0.0};
+    double reaped_percent{0.0};
+    double irq_percent{0.0};                // no process is charged with these two
+    double steal_percent{0.0};
+    int born{0};
+    int exited{0};
+};
+
+// Compares the per-process deltas against the time the system charged to
+// tasks (user, nice, system); irq, softirq and steal are reported on their
+// own since no process accounts for them. Whatever the scans could not see
+// (processes that lived and died between two scans and were not yet reaped
+// by a live parent) is reported as unaccounted.
+CpuAccounting account_cpu(const ProcMap &procs,
+                          const ProcMap &prev,
+                          const SystemSnapshot &cur_snap,
+                          const SystemSnapshot &prev_snap) {
+    CpuAccounting a;
+    // A snapshot restored from a checkpoint only carries total and idle; the
+    // restore zeroes the split, which would charge all task time since boot.
+    if (cur_snap.total_jiffies <= prev_snap.total_jiffies || !prev_snap.task_jiffies) return a;
+    unsigned long long total_diff = cur_snap.total_jiffies - prev_snap.total_jiffies;
+    auto delta = [](unsigned long long cur, unsigned long long prev) { return cur >= prev ? cur - prev : 0ULL; };
+    a.busy_jiffies = delta(cur_snap.task_jiffies, prev_snap.task_jiffies);
+    double per_cpu = 100.0 * cur_snap.num_cpus / (double)total_diff;
+    a.irq_percent = delta(cur_snap.irq_jiffies, prev_snap.irq_jiffies) * per_cpu;
+    a.steal_percent = delta(cur_snap.steal_jiffies, prev_snap.steal_jiffies) * per_cpu;
+
+    long long reaped = 0;
+    for (auto &kv : procs) {
+        const ProcInfo &p = kv.second;
+        unsigned long long own = (unsigned long long)p.utime + p.stime;
+        auto it = prev.find(kv.first);
+        if (it == prev.end()) {
+            a.born_jiffies += own;
+            a.born++;
+            continue;
+        }
+        // Counters carried over from an earlier tick cover more than this
+        // interval; only this interval's share of their delta is counted.
+        unsigned long long span = read_span(it->second, cur_snap, prev_snap);
+        double share = span > total_diff ? (double)total_diff / (double)span : 1.0;
+        unsigned long long prev_own = (unsigned long long)it->second.utime + it->second.stime;
+        if (own >= prev_own) a.seen_jiffies += (unsigned long long)((own - prev_own) * share);
+        unsigned long long child = (unsigned long long)p.cutime + p.cstime;
+        unsigned long long prev_child = (unsigned long long)it->second.cutime + it->second.cstime;
+        if (child >= prev_child) reaped += (long long)((child - prev_child) * share);
+    }
+    // A child we already saw in the previous scan had its earlier time counted
+    // there; only the remainder charged to the parent is new.
+    for (auto &kv : prev) {
+        if (procs.count(kv.first)) continue;
+        a.exited++;
+        const ProcInfo &e = kv.second;
+        auto parent = procs.lower_bound(ProcKey{e.ppid, 0});
+        if (parent != procs.end() && parent->first.pid == e.ppid) reaped -= (long long)e.total_time;
+    }
+    a.reaped_jiffies = reaped > 0 ? (unsigned long long)reaped : 0;
+
+    unsigned long long accounted = a.seen_jiffies + a.born_jiffies + a.reaped_jiffies;
+    a.unaccounted_jiffies = a.busy_jiffies > accounted ? a.busy_jiffies - accounted : 0;
+    a.unaccounted_percent = (double)a.unaccounted_jiffies / (double)total_diff * 100.0 * cur_snap.num_cpus;
+    a.reaped_percent = (double)a.reaped_jiffies / (double)total_diff * 100.0 * cur_snap.num_cpus;
+    return a;
+}
+
+static std::string clock_string(std::time_t t = std::time(nullptr)) {
+    char buf[16];
+    struct tm tmv;
+    localtime_r(&t, &tmv);
+    std::strftime(buf, sizeof(buf), "%H:%M:%S", &tmv);
+    return buf;
 }
 
-void draw_processes(WINDOW *w, const std::vector<ProcInfo> &plist, int start, int height) {
-    werase(w);
-    int row = 0;
-    for (int i = start; i < (int)plist.size() && row < height; ++i, ++row) {
-        const ProcInfo &p = plist[i];
-        long rss_kb = p.rss * (sysconf(_SC_PAGESIZE) / 1024);
-        mvwprintw(w, row, 0, "%5d %7.2f %8.2f %10ld  %.60s", p.pid, p.cpu_percent, p.mem_percent, rss_kb, p.cmd.c_str());
+static uint64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Number formatting for the per-row output paths (process list, trace and
+// query export) without printf. Integers go through std::to_chars; a
+// fixed-point value is scaled and rounded to an integer and printed as
+// integer and fraction digits. Each put_* writes at `out`, right-aligned in
+// `width` as the printf equivalent would be (wider values are written in
+// full), and returns the end of what it wrote. `out` needs room for
+// max(width, 48) characters.
+static char *put_padded(char *out, const char *s, size_t n, int width) {
+    if ((int)n < width) {
+        memset(out, ' ', width - n);
+        out += width - n;
     }
-    wrefresh(w);
+    memcpy(out, s, n);
+    return out + n;
 }
 
-int main() {
-    initscr();
-    cbreak();
-    noecho();
-    nodelay(stdscr, TRUE);
-    keypad(stdscr, TRUE);
-    curs_set(0);
+// "%*lld"
+static char *put_int(char *out, long long v, int width = 0) {
+    char tmp[24];
+    char *end = std::to_chars(tmp, tmp + sizeof(tmp), v).ptr;
+    return put_padded(out, tmp, end - tmp, width);
+}
 
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
+// "%*.*f" for decimals 0-4. Agrees with printf except on exact binary
+// ties, which printf rounds to even.
+static char *put_fixed(char *out, double v, int decimals, int width = 0) {
+    static const long long scale[] = {1, 10, 100, 1000, 10000};
+    char tmp[48];
+    char *p = tmp;
+    decimals = std::max(0, std::min(decimals, 4));
+    if (!(std::fabs(v) < 1e14)) {
+        // Out of fixed-point range (or not finite): the library conversion.
+        auto r = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::fixed, decimals);
+        if (r.ec != std::errc()) r = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::scientific, decimals);
+        return put_padded(out, tmp, r.ptr - tmp, width);
+    }
+    long long s = std::llround(std::fabs(v) * scale[decimals]);
+    if (std::signbit(v)) *p++ = '-';
+    p = std::to_chars(p, tmp + sizeof(tmp), s / scale[decimals]).ptr;
+    if (decimals) {
+        *p++ = '.';
+        long long frac = s % scale[decimals];
+        for (int d = decimals - 1; d >= 0; --d, frac /= 10) p[d] = (char)('0' + frac % 10);
+        p += decimals;
+    }
+    return put_padded(out, tmp, p - tmp, width);
+}
+
+// Bounded single-producer/single-consumer queue. push() never waits: when the
+// consumer falls behind the event is dropped and counted, so a producer on
+// the sampling path is never held up by the UI.
+template <typename T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+public:
+    bool push(const T &v) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h - tail_.load(std::memory_order_acquire) == N) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        buf_[h & (N - 1)] = v;
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T &v) {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t == head_.load(std::memory_order_acquire)) return false;
+        v = buf_[t & (N - 1)];
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    unsigned long long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+private:
+    T buf_[N];
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<unsigned long long> dropped_{0};
+};
 
-    WINDOW *header = newwin(3, cols, 0, 0);
-    WINDOW *procwin = newwin(rows - 3, cols, 3, 0);
+struct ProcEvent {
+    enum Kind : uint8_t { START, EXEC, EXIT };
+    uint64_t time_ns;
+    Kind kind;
+    int32_t pid, ppid;
+    float cpu_s;          // exit: final utime + stime
+    float lifetime_s;     // exit: time since start, <0 if unknown
+    int64_t peak_rss_kb;  // exit: <0 if unknown
+    char comm[40];
+};
 
-    SystemSnapshot prev_snap = read_system_snapshot();
-    auto prev_procs = read_all_procs();
+typedef SpscRing<ProcEvent, 4096> ProcEventRing;
 
-    int refresh_interval = 2;
-    bool sort_by_cpu = true;
-    int offset = 0;
+static ProcEvent make_event(ProcEvent::Kind kind, int pid, int ppid, const std::string &comm) {
+    ProcEvent e;
+    e.time_ns = realtime_ns();
+    e.kind = kind;
+    e.pid = pid;
+    e.ppid = ppid;
+    e.cpu_s = 0;
+    e.lifetime_s = -1;
+    e.peak_rss_kb = -1;
+    snprintf(e.comm, sizeof(e.comm), "%s", comm.c_str());
+    return e;
+}
 
-    while (true) {
-        SystemSnapshot cur_snap = read_system_snapshot();
-        auto cur_procs = read_all_procs();
-        compute_cpu_mem_percent(cur_procs, prev_procs, cur_snap, prev_snap);
+// Start/exec/exit events from the difference between two consecutive scans.
+// Both maps are ordered by (pid, starttime) so one merge pass finds them; a
+// changed command line under the same identity is reported as an exec
+// (except kernel threads, which rename themselves constantly). Exit lifetimes
+// run to the last scan that saw the process. Also carries peak_rss forward so
+// exits can report it.
+void detect_proc_events(ProcMap &cur, const ProcMap &prev, ProcEventRing &ring) {
+    static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+    static long clk_tck = sysconf(_SC_CLK_TCK);
+    struct timespec bt;
+    clock_gettime(CLOCK_BOOTTIME, &bt);
+    double uptime_s = bt.tv_sec + bt.tv_nsec / 1e9;
+    static double last_seen_s = uptime_s;
+    auto c = cur.begin();
+    auto p = prev.begin();
+    while (c != cur.end() || p != prev.end()) {
+        if (p == prev.end() || (c != cur.end() && c->first < p->first)) {
+            c->second.peak_rss = c->second.rss;
+            ring.push(make_event(ProcEvent::START, c->second.pid, c->second.ppid, c->second.cmd));
+            ++c;
+        } else if (c == cur.end() || p->first < c->first) {
+            const ProcInfo &q = p->second;
+            ProcEvent e = make_event(ProcEvent::EXIT, q.pid, q.ppid, q.cmd);
+            e.cpu_s = (float)(q.utime + q.stime) / clk_tck;
+            e.lifetime_s = (float)(last_seen_s - (double)q.starttime / clk_tck);
+            e.peak_rss_kb = std::max(q.peak_rss, q.rss) * page_size_kb;
+            ring.push(e);
+            ++p;
+        } else {
+            c->second.peak_rss = std::max(c->second.rss, p->second.peak_rss);
+            bool kthread = c->second.pid == 2 || c->second.ppid == 2;
+            if (c->second.cmd != p->second.cmd && !kthread)
+                ring.push(make_event(ProcEvent::EXEC, c->second.pid, c->second.ppid, c->second.cmd));
+            ++c;
+            ++p;
+        }
+    }
+    last_seen_s = uptime_s;
+}
 
-        std::vector<ProcInfo> plist;
-        for (auto &kv : cur_procs) plist.push_back(kv.second);
+// UI-side event history. Only the UI thread touches it; producers hand it
+// events through ProcEventRings which it drains once per frame.
+class EventLog {
+public:
+    explicit EventLog(size_t cap = 4096) : cap_(cap) {}
+    void push(const std::string &msg, std::time_t t = std::time(nullptr)) {
+        lines_.push_back(clock_string(t) + " " + msg);
+        if (lines_.size() > cap_) lines_.pop_front();
+    }
+    size_t drain(ProcEventRing &ring) {
+        ProcEvent e;
+        size_t n = 0;
+        char line[160];
+        while (ring.pop(e)) {
+            ++n;
+            if (e.kind == ProcEvent::START)
+                snprintf(line, sizeof(line), "start %d (ppid %d) %s", e.pid, e.ppid, e.comm);
+            else if (e.kind == ProcEvent::EXEC)
+                snprintf(line, sizeof(line), "exec  %d %s", e.pid, e.comm);
+            else {
+                int len = snprintf(line, sizeof(line), "exit  %d %s cpu %.2fs", e.pid, e.comm, e.cpu_s);
+                if (e.peak_rss_kb >= 0)
+                    len += snprintf(line + len, sizeof(line) - len, " peak %lld KB", (long long)e.peak_rss_kb);
+                if (e.lifetime_s >= 0)
+                    snprintf(line + len, sizeof(line) - len, " lived %s", format_lifetime(e.lifetime_s).c_str());
+            }
+            push(line, (std::time_t)(e.time_ns / 1000000000ULL));
+        }
+        return n;
+    }
+    size_t size() const { return lines_.size(); }
+    // n lines ending `back` lines before the newest.
+    std::vector<std::string> window(size_t n, size_t back) const {
+        size_t end = lines_.size() > back ? lines_.size() - back : 0;
+        size_t from = end > n ? end - n : 0;
+        return std::vector<std::string>(lines_.begin() + from, lines_.begin() + end);
+    }
+private:
+    static std::string format_lifetime(double s) {
+        char buf[32];
+        if (s < 1) snprintf(buf, sizeof(buf), "%.0fms", s * 1000);
+        else if (s < 3600) snprintf(buf, sizeof(buf), "%.1fs", s);
+        else snprintf(buf, sizeof(buf), "%.1fh", s / 3600);
+        return buf;
+    }
+    size_t cap_;
+    std::deque<std::string> lines_;
+};
 
-        if (sort_by_cpu)
-            std::sort(plist.begin(), plist.end(), [](const ProcInfo &a, const ProcInfo &b){
-                return a.cpu_percent > b.cpu_percent;
-            });
-        else
-            std::sort(plist.begin(), plist.end(), [](const ProcInfo &a, const ProcInfo &b){
-                return a.mem_percent > b.mem_percent;
-            });
+// Listens on the netlink process connector for exec/exit events so that
+// processes living shorter than one refresh interval are still recorded.
+// Needs CAP_NET_ADMIN; start() returns false when unavailable.
+class ProcConnector {
+public:
+    ProcConnector() = default;
+    ~ProcConnector() { stop(); }
+
+    bool start(unsigned long long short_ns) {
+        short_ns_ = short_ns;
+        fd_ = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (fd_ < 0) return false;
+        struct sockaddr_nl sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.nl_family = AF_NETLINK;
+        sa.nl_groups = CN_IDX_PROC;
+        sa.nl_pid = 0;
+        if (bind(fd_, (struct sockaddr *)&sa, sizeof(sa)) < 0 || !set_listen(true)) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        running_ = true;
+        try {
+            th_ = std::thread([this]{ loop(); });
+        } catch (const std::system_error &) {
+            // No threads left (pid exhaustion); run without the connector.
+            running_ = false;
+            set_listen(false);
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    void stop() {
+        if (!running_.exchange(false)) return;
+        if (th_.joinable()) th_.join();
+        set_listen(false);
+        close(fd_);
+        fd_ = -1;
+    }
+
+    unsigned long long short_lived() const { return short_lived_.load(); }
+    ProcEventRing &events() { return ring_; }
+
+private:
+    struct Exec { unsigned long long ts_ns; std::string comm; };
+
+    bool set_listen(bool on) {
+        alignas(struct nlmsghdr) char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+        memset(buf, 0, sizeof(buf));
+        struct nlmsghdr *nl = (struct nlmsghdr *)buf;
+        struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(nl);
+        nl->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+        nl->nlmsg_pid = getpid();
+        nl->nlmsg_type = NLMSG_DONE;
+        cn->id.idx = CN_IDX_PROC;
+        cn->id.val = CN_VAL_PROC;
+        cn->len = sizeof(enum proc_cn_mcast_op);
+        enum proc_cn_mcast_op op = on ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+        memcpy(cn->data, &op, sizeof(op));
+        return send(fd_, buf, nl->nlmsg_len, 0) >= 0;
+    }
 
-        draw_header(header, cols, cur_snap);
-        draw_processes(procwin, plist, offset, rows - 3);
+    void loop() {
+        alignas(struct nlmsghdr) char buf[4096];
+        while (running_) {
+            struct pollfd pfd{fd_, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0) continue;
+            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+            if (n <= 0) continue;
+            for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (size_t)n); nh = NLMSG_NEXT(nh, n)) {
+                if (nh->nlmsg_type == NLMSG_ERROR || nh->nlmsg_type == NLMSG_NOOP) continue;
+                struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(nh);
+                handle((struct proc_event *)cn->data);
+            }
+        }
+    }
 
-        int ch = getch();
-        if (ch != ERR) {
-            if (ch == 'q' || ch == 'Q') break;
-            else if (ch == 's' || ch == 'S') sort_by_cpu = !sort_by_cpu;
-            else if (ch == KEY_DOWN && offset + (rows-3) < (int)plist.size()) offset++;
-            else if (ch == KEY_UP && offset > 0) offset--;
+    void handle(const struct proc_event *ev) {
+        if (ev->what == proc_event::PROC_EVENT_EXEC) {
+            int pid = ev->event_data.exec.process_tgid;
+            std::string comm;
+            std::ifstream f(g_proc_root + "/" + std::to_string(pid) + "/comm");
+            if (!std::getline(f, comm)) comm = "?";
+            if (execs_.size() > 65536) execs_.clear();
+            execs_[pid] = Exec{ev->timestamp_ns, comm};
+        } else if (ev->what == proc_event::PROC_EVENT_EXIT) {
+            if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid) return;
+            auto it = execs_.find(ev->event_data.exit.process_tgid);
+            if (it == execs_.end()) return;
+            unsigned long long runtime = ev->timestamp_ns - it->second.ts_ns;
+            if (runtime < short_ns_) {
+                // Too short for the scan diff to have seen; the zombie's stat still has its CPU time.
+                short_lived_++;
+                ProcEvent e = make_event(ProcEvent::EXIT, it->first, -1, it->second.comm);
+                e.lifetime_s = (float)(runtime / 1e9);
+                std::ifstream f(g_proc_root + "/" + std::to_string(it->first) + "/stat");
+                std::string line;
+                if (std::getline(f, line) && line.rfind(')') != std::string::npos) {
+                    // utime and stime; a stat cut short as the task goes away
+                    // drops the event, since this thread must not throw.
+                    auto toks = split(line.substr(line.rfind(')') + 1));
+                    auto field = [&](size_t i, unsigned long &v) {
+                        char *end = nullptr;
+                        if (i >= toks.size()) return false;
+                        v = strtoul(toks[i].c_str(), &end, 10);
+                        return end != toks[i].c_str() && !*end;
+                    };
+                    unsigned long ut, st;
+                    if (!field(11, ut) || !field(12, st)) {
+                        execs_.erase(it);
+                        return;
+                    }
+                    e.cpu_s = (float)(ut + st) / sysconf(_SC_CLK_TCK);
+                }
+                ring_.push(e);
+            }
+            execs_.erase(it);
         }
+    }
 
-        prev_snap = cur_snap;
-        prev_procs = cur_procs;
+    ProcEventRing ring_;
+    int fd_{-1};
+    unsigned long long short_ns_{0};
+    std::atomic<bool> running_{false};
+    std::atomic<unsigned long long> short_lived_{0};
+    std::thread th_;
+    std::unordered_map<int, Exec> execs_;
+};
+
+// RRD-style long-term store in one fixed-size mmap'd file. Every series has
+// the same tiers (1 s for an hour, 10 s for a day, 1 min for a month); a
+// bucket is addressed by epoch % buckets and tagged with its epoch, so stale
+// buckets from before a gap or from a recycled series are recognised on read
+// and never need clearing.
+// Each sample touches one accumulator per tier, independent of retention
+// length.
+class RetentionStore {
+public:
+    enum Metric { CPU, RSS_KB, NUM_METRICS };
+    enum Kind : uint8_t { KIND_FREE = 0, KIND_PROC = 1, KIND_CGROUP = 2 };
+    static const int NUM_TIERS = 3;
+    static constexpr uint32_t tier_step_s[NUM_TIERS] = {1, 10, 60};
+    static constexpr uint32_t tier_buckets[NUM_TIERS] = {3600, 8640, 43200};
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t max_series;
+        uint32_t num_tiers;
+        uint32_t num_metrics;
+        uint32_t step_s[NUM_TIERS];
+        uint32_t buckets[NUM_TIERS];
+        uint64_t created;
+    };
+    struct Accum {
+        uint32_t epoch;
+        uint32_t count;
+        float min[NUM_METRICS];
+        float max[NUM_METRICS];
+        float sum[NUM_METRICS];
+    };
+    struct Series {
+        uint8_t kind;
+        uint8_t pad[3];
+        int32_t pid;
+        uint64_t starttime;
+        uint64_t first_update;
+        uint64_t last_update;
+        char label[96];
+        Accum acc[NUM_TIERS];
+    };
+    struct Bucket {
+        uint32_t epoch;
+        float min[NUM_METRICS];
+        float avg[NUM_METRICS];
+        float max[NUM_METRICS];
+    };
 
-        std::this_thread::sleep_for(std::chrono::seconds(refresh_interval));
+    ~RetentionStore() { close(); }
+
+    static size_t series_bytes() {
+        size_t n = 0;
+        for (int t = 0; t < NUM_TIERS; ++t) n += (size_t)tier_buckets[t] * sizeof(Bucket);
+        return n;
+    }
+    static size_t file_bytes(uint32_t max_series) {
+        return sizeof(Header) + (size_t)max_series * (sizeof(Series) + series_bytes());
     }
 
-    delwin(header);
-    delwin(procwin);
-    endwin();
-    return 0;
+    // Opens or creates the store. When writable is false the file is mapped
+    // read-only and its own max_series is used.
+    bool open(const std::string &path, uint32_t max_series, bool writable = true) {
+        close();
+        fd_ = ::open(path.c_str(), writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) < 0) { close(); return false; }
+        bool fresh = st.st_size == 0;
+        if (!fresh) {
+            Header h;
+            if (pread(fd_, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || !compatible(h) ||
+                (size_t)st.st_size != file_bytes(h.max_series)) {
+                close();
+                return false;
+            }
+            max_series = h.max_series;
+        } else if (!writable || ftruncate(fd_, (off_t)file_bytes(max_series)) < 0) {
+            close();
+            return false;
+        }
+        size_ = file_bytes(max_series);
+        void *m = mmap(nullptr, size_, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd_, 0);
+        if (m == MAP_FAILED) { close(); return false; }
+        base_ = (char *)m;
+        if (fresh) {
+            Header *h = header();
+            memcpy(h->magic, "SYSMRRD1", 8);
+            h->version = 1;
+            h->max_series = max_series;
+            h->num_tiers = NUM_TIERS;
+            h->num_metrics = NUM_METRICS;
+            for (int t = 0; t < NUM_TIERS; ++t) {
+                h->step_s[t] = tier_step_s[t];
+                h->buckets[t] = tier_buckets[t];
+            }
+            h->created = (uint64_t)std::time(nullptr);
+        }
+        index_.clear();
+        free_.clear();
+        older_.assign(max_series, NIL);
+        newer_.assign(max_series, NIL);
+        oldest_ = newest_ = NIL;
+        std::vector<uint32_t> used;
+        for (uint32_t i = max_series; i-- > 0;) {
+            const Series *sr = series(i);
+            if (sr->kind == KIND_FREE) {
+                free_.push_back(i);
+            } else {
+                index_.emplace(identity(sr->kind, sr->pid, sr->starttime, sr->label), i);
+                used.push_back(i);
+            }
+        }
+        std::sort(used.begin(), used.end(),
+                  [this](uint32_t a, uint32_t b) { return series(a)->last_update < series(b)->last_update; });
+        for (uint32_t i : used) link_newest(i);
+        return true;
+    }
+
+    void close() {
+        if (base_) {
+            msync(base_, size_, MS_ASYNC);
+            munmap(base_, size_);
+            base_ = nullptr;
+        }
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        index_.clear();
+        free_.clear();
+        older_.clear();
+        newer_.clear();
+        oldest_ = newest_ = NIL;
+    }
+
+    bool is_open() const { return base_ != nullptr; }
+    uint32_t max_series() const { return header()->max_series; }
+    const Header *header() const { return (const Header *)base_; }
+    const Series *series(uint32_t i) const { return (const Series *)(base_ + sizeof(Header)) + i; }
+
+    // Bucket for tier t of series i at the given epoch, or nullptr when that
+    // slot holds an older epoch or data from a previous owner of the series.
+    const Bucket *find_bucket(uint32_t i, int t, uint32_t epoch) const {
+        const Series *sr = series(i);
+        if ((uint64_t)epoch * tier_step_s[t] < sr->first_update - sr->first_update % tier_step_s[t]) return nullptr;
+        const Bucket *b = bucket(i, t, epoch);
+        return b->epoch == epoch ? b : nullptr;
+    }
+
+    const Bucket *bucket(uint32_t i, int t, uint32_t epoch) const {
+        const char *data = base_ + sizeof(Header) + (size_t)max_series() * sizeof(Series) + (size_t)i * series_bytes();
+        for (int k = 0; k < t; ++k) data += (size_t)tier_buckets[k] * sizeof(Bucket);
+        return (const Bucket *)data + epoch % tier_buckets[t];
+    }
+
+    // Finds or allocates the series for an identity. A new series takes a free
+    // slot, else recycles the least recently updated one, but never a series
+    // fed within the last tier-0 step: a store too small for the live set
+    // refuses the newcomer rather than churning. Returns UINT32_MAX then.
+    uint32_t series_for(Kind kind, int pid, unsigned long long starttime, const std::string &label, uint64_t now) {
+        uint64_t k = identity(kind, pid, starttime, label.c_str());
+        auto range = index_.equal_range(k);
+        for (auto it = range.first; it != range.second; ++it)
+            if (same(it->second, kind, pid, starttime, label.c_str())) return it->second;
+        uint32_t victim;
+        if (!free_.empty()) {
+            victim = free_.back();
+            free_.pop_back();
+        } else {
+            victim = oldest_;
+            if (victim == NIL || series(victim)->last_update + tier_step_s[0] > now) return NIL;
+            const Series *old = series(victim);
+            auto r = index_.equal_range(identity(old->kind, old->pid, old->starttime, old->label));
+            for (auto it = r.first; it != r.second; ++it)
+                if (it->second == victim) { index_.erase(it); break; }
+            unlink(victim);
+        }
+        Series *sr = mseries(victim);
+        memset(sr, 0, sizeof(*sr));
+        sr->kind = kind;
+        sr->pid = pid;
+        sr->starttime = starttime;
+        sr->first_update = now;
+        sr->last_update = now;
+        snprintf(sr->label, sizeof(sr->label), "%s", label.c_str());
+        index_.emplace(k, victim);
+        link_newest(victim);
+        return victim;
+    }
+
+    void add(uint32_t i, uint64_t now, const float (&vals)[NUM_METRICS]) {
+        Series *sr = mseries(i);
+        sr->last_update = now;
+        if (i != newest_) {
+            unlink(i);
+            link_newest(i);
+        }
+        for (int t = 0; t < NUM_TIERS; ++t) {
+            Accum &a = sr->acc[t];
+            uint32_t epoch = (uint32_t)(now / tier_step_s[t]);
+            if (a.epoch != epoch) {
+                if (a.count) flush(i, t, a);
+                a.epoch = epoch;
+                a.count = 0;
+            }
+            for (int m = 0; m < NUM_METRICS; ++m) {
+                if (!a.count || vals[m] < a.min[m]) a.min[m] = vals[m];
+                if (!a.count || vals[m] > a.max[m]) a.max[m] = vals[m];
+                a.sum[m] = (a.count ? a.sum[m] : 0.0f) + vals[m];
+            }
+            a.count++;
+        }
+    }
+
+private:
+    static bool compatible(const Header &h) {
+        if (memcmp(h.magic, "SYSMRRD1", 8) != 0 || h.version != 1 || h.num_tiers != NUM_TIERS || h.num_metrics != NUM_METRICS)
+            return false;
+        for (int t = 0; t < NUM_TIERS; ++t)
+            if (h.step_s[t] != tier_step_s[t] || h.buckets[t] != tier_buckets[t]) return false;
+        return true;
+    }
+
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    // Processes are identified by (pid, starttime) alone; their label is the
+    // command, which may change. Only cgroup series are keyed by their path.
+    // The hash may collide, so index hits are confirmed with same().
+    static uint64_t identity(uint8_t kind, int pid, unsigned long long starttime, const char *label) {
+        uint64_t h = starttime * 0x9E3779B97F4A7C15ull ^ (uint32_t)pid;
+        if (kind == KIND_CGROUP) h = std::hash<std::string_view>()({label, strnlen(label, sizeof(Series::label) - 1)});
+        return (h ^ h >> 29) * 0xBF58476D1CE4E5B9ull ^ kind;
+    }
+    bool same(uint32_t i, uint8_t kind, int pid, unsigned long long starttime, const char *label) const {
+        const Series *sr = series(i);
+        if (sr->kind != kind) return false;
+        if (kind == KIND_CGROUP) return strncmp(sr->label, label, sizeof(sr->label) - 1) == 0;
+        return sr->pid == pid && sr->starttime == starttime;
+    }
+
+    // In-memory list of used series from least to most recently updated, so
+    // picking an eviction victim does not scan the file.
+    void unlink(uint32_t i) {
+        (older_[i] == NIL ? oldest_ : newer_[older_[i]]) = newer_[i];
+        (newer_[i] == NIL ? newest_ : older_[newer_[i]]) = older_[i];
+        older_[i] = newer_[i] = NIL;
+    }
+    void link_newest(uint32_t i) {
+        older_[i] = newest_;
+        newer_[i] = NIL;
+        (newest_ == NIL ? oldest_ : newer_[newest_]) = i;
+        newest_ = i;
+    }
+
+    Header *header() { return (Header *)base_; }
+    Series *mseries(uint32_t i) { return const_cast<Series *>(series(i)); }
+    Bucket *mbucket(uint32_t i, int t, uint32_t epoch) { return const_cast<Bucket *>(bucket(i, t, epoch)); }
+
+    void flush(uint32_t i, int t, const Accum &a) {
+        Bucket *b = mbucket(i, t, a.epoch);
+        b->epoch = a.epoch;
+        for (int m = 0; m < NUM_METRICS; ++m) {
+            b->min[m] = a.min[m];
+            b->max[m] = a.max[m];
+            b->avg[m] = a.sum[m] / (float)a.count;
+        }
+    }
+
+    int fd_{-1};
+    char *base_{nullptr};
+    size_t size_{0};
+    std::unordered_multimap<uint64_t, uint32_t> index_;
+    std::vector<uint32_t> free_;
+    std::vector<uint32_t> older_, newer_;
+    uint32_t oldest_{NIL}, newest_{NIL};
+};
+constexpr uint32_t RetentionStore::tier_step_s[RetentionStore::NUM_TIERS];
+constexpr uint32_t RetentionStore::tier_buckets[RetentionStore::NUM_TIERS];
+constexpr uint32_t RetentionStore::NIL;
+
+// Feeds one tick into the store: the top_n processes by CPU and the top_n by
+// resident memory get a series, and each cgroup gets the sum of all its
+// processes. Capping the process set keeps the store from churning on hosts
+// with more live processes than series.
+void feed_retention(RetentionStore &store, const ProcMap &procs, size_t top_n, uint64_t now) {
+    static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+    std::unordered_map<std::string, std::pair<float, float>> cgroups;
+    std::vector<const ProcInfo *> by_cpu, by_rss;
+    for (auto &kv : procs) {
+        const ProcInfo &p = kv.second;
+        if (!p.cgroup.empty()) {
+            auto &c = cgroups[p.cgroup];
+            c.first += (float)p.cpu_percent;
+            c.second += (float)(p.rss * page_size_kb);
+        }
+        if (p.cpu_avg[2] >= 0.1) by_cpu.push_back(&p);
+        if (p.rss) by_rss.push_back(&p);
+    }
+    auto top = [top_n](std::vector<const ProcInfo *> &v, auto key) {
+        size_t n = std::min(top_n, v.size());
+        std::partial_sort(v.begin(), v.begin() + n, v.end(),
+                          [&](const ProcInfo *a, const ProcInfo *b) { return key(a) > key(b); });
+        v.resize(n);
+    };
+    top(by_cpu, [](const ProcInfo *p) { return p->cpu_percent; });
+    top(by_rss, [](const ProcInfo *p) { return p->rss; });
+    std::unordered_set<const ProcInfo *> fed;
+    for (auto *v : {&by_cpu, &by_rss})
+        for (const ProcInfo *p : *v) {
+            if (!fed.insert(p).second) continue;
+            uint32_t i = store.series_for(RetentionStore::KIND_PROC, p->pid, p->starttime, p->cmd, now);
+            if (i == UINT32_MAX) continue;
+            float vals[RetentionStore::NUM_METRICS] = {(float)p->cpu_percent, (float)(p->rss * page_size_kb)};
+            store.add(i, now, vals);
+        }
+    for (auto &kv : cgroups) {
+        uint32_t i = store.series_for(RetentionStore::KIND_CGROUP, 0, 0, kv.first, now);
+        if (i == UINT32_MAX) continue;
+        float vals[RetentionStore::NUM_METRICS] = {kv.second.first, kv.second.second};
+        store.add(i, now, vals);
+    }
 }
 
+// Sampling state kept across restarts: the last system snapshot, the last
+// per-process counters and each process's history ring, so the first tick
+// after a restart computes rates against the previous run's last tick
+// instead of starting from zero. The file is built in a temp file through
+// mmap and renamed over the old one, so a crash mid-write leaves the
+// previous checkpoint intact. It is only used when it comes from the same
+// boot, and only for processes whose (pid, starttime) is still running.
+class StateCheckpoint {
+public:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t nprocs;
+        uint64_t boot_time;
+        uint64_t written;
+        uint32_t page_kb;
+        uint32_t clk_tck;
+        uint32_t depth;
+        uint32_t num_metrics;
+        uint64_t total_jiffies;
+        uint64_t idle_jiffies;
+        uint64_t mem_total_kb;
+        uint64_t mem_free_kb;
+        uint64_t mem_available_kb;
+        int32_t num_cpus;
+        uint32_t strings_bytes;
+        uint64_t hist_floats;
+    };
+    struct Proc {
+        int32_t pid;
+        int32_t ppid;
+        uint64_t starttime;
+        uint64_t utime, stime, cutime, cstime, total_time;
+        uint64_t io_read_bytes, io_write_bytes;
+        uint64_t minflt, majflt;
+        int64_t rss, peak_rss;
+        double cpu_avg[CpuEwma::NUM_WINDOWS];
+        uint64_t hist_off;  // in floats, NUM_METRICS columns of hist_count each
+        uint32_t hist_count;
+        uint32_t cmd_off;
+    };
+
+    static bool save(const std::string &path, const SystemSnapshot &snap, const ProcMap &procs,
+                     const MetricHistory &hist) {
+        uint64_t hist_floats = 0;
+        size_t strings = 0;
+        for (auto &kv : procs) {
+            hist_floats += (uint64_t)MetricHistory::NUM_METRICS * hist.count(kv.second.slot);
+            strings += kv.second.cmd.size() + 1;
+        }
+        size_t bytes = sizeof(Header) + procs.size() * sizeof(Proc) + hist_floats * sizeof(float) + strings;
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        void *m = ftruncate(fd, (off_t)bytes) == 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                                   : MAP_FAILED;
+        if (m == MAP_FAILED) {
+            ::close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        char *base = (char *)m;
+        Header *h = (Header *)base;
+        memcpy(h->magic, "SYSMCKP1", 8);
+        h->version = 1;
+        h->nprocs = (uint32_t)procs.size();
+        h->boot_time = read_boot_time();
+        h->written = (uint64_t)std::time(nullptr);
+        h->page_kb = (uint32_t)(sysconf(_SC_PAGESIZE) / 1024);
+        h->clk_tck = (uint32_t)sysconf(_SC_CLK_TCK);
+        h->depth = (uint32_t)hist.depth();
+        h->num_metrics = MetricHistory::NUM_METRICS;
+        h->total_jiffies = snap.total_jiffies;
+        h->idle_jiffies = snap.idle_jiffies;
+        h->mem_total_kb = snap.mem_total_kb;
+        h->mem_free_kb = snap.mem_free_kb;
+        h->mem_available_kb = snap.mem_available_kb;
+        h->num_cpus = snap.num_cpus;
+        h->strings_bytes = (uint32_t)strings;
+        h->hist_floats = hist_floats;
+        Proc *r = (Proc *)(base + sizeof(Header));
+        float *floats = (float *)(r + procs.size());
+        char *str = (char *)(floats + hist_floats);
+        uint64_t foff = 0;
+        uint32_t soff = 0;
+        for (auto &kv : procs) {
+            const ProcInfo &p = kv.second;
+            r->pid = p.pid;
+            r->ppid = p.ppid;
+            r->starttime = p.starttime;
+            r->utime = p.utime;
+            r->stime = p.stime;
+            r->cutime = p.cutime;
+            r->cstime = p.cstime;
+            r->total_time = p.total_time;
+            r->io_read_bytes = p.io_read_bytes;
+            r->io_write_bytes = p.io_write_bytes;
+            r->minflt = p.minflt;
+            r->majflt = p.majflt;
+            r->rss = p.rss;
+            r->peak_rss = p.peak_rss;
+            for (int w = 0; w < CpuEwma::NUM_WINDOWS; ++w) r->cpu_avg[w] = p.cpu_avg[w];
+            r->hist_off = foff;
+            r->hist_count = (uint32_t)hist.count(p.slot);
+            for (int mt = 0; mt < MetricHistory::NUM_METRICS; ++mt)
+                foff += hist.read(p.slot, (MetricHistory::Metric)mt, floats + foff, r->hist_count);
+            r->cmd_off = soff;
+            memcpy(str + soff, p.cmd.c_str(), p.cmd.size() + 1);
+            soff += (uint32_t)p.cmd.size() + 1;
+            ++r;
+        }
+        bool ok = msync(base, bytes, MS_SYNC) == 0;
+        munmap(base, bytes);
+        ::close(fd);
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Restores the checkpoint for the processes in `live` (the current scan):
+    // their previous counters go to `prev`, their history into `hist` and
+    // their averages into `ewma`, on the slots `table` has for them. Returns
+    // false, touching nothing, when the file is missing, damaged, from
+    // another boot or machine setup, or older than `max_age_s`.
+    static bool load(const std::string &path, const ProcMap &live, uint64_t max_age_s, SystemSnapshot &snap,
+                     ProcMap &prev, ProcTable &table, MetricHistory &hist, CpuEwma &ewma, std::string &why) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            why = "no checkpoint";
+            return false;
+        }
+        struct stat st;
+        void *m = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+            m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            why = "unreadable checkpoint";
+            return false;
+        }
+        bool ok = restore((const char *)m, (size_t)st.st_size, live, max_age_s, snap, prev, table, hist, ewma, why);
+        munmap(m, st.st_size);
+        return ok;
+    }
+
+private:
+    static bool restore(const char *base, size_t size, const ProcMap &live, uint64_t max_age_s,
+                        SystemSnapshot &snap, ProcMap &prev, ProcTable &table, MetricHistory &hist, CpuEwma &ewma,
+                        std::string &why) {
+        const Header *h = (const Header *)base;
+        if (memcmp(h->magic, "SYSMCKP1", 8) != 0 || h->version != 1 ||
+            size != sizeof(Header) + (size_t)h->nprocs * sizeof(Proc) + h->hist_floats * sizeof(float) +
+                        h->strings_bytes) {
+            why = "not a checkpoint";
+            return false;
+        }
+        SystemSnapshot now = read_system_snapshot();
+        uint64_t age = (uint64_t)std::time(nullptr) - std::min<uint64_t>(h->written, (uint64_t)std::time(nullptr));
+        if (h->boot_time != read_boot_time() || h->total_jiffies > now.total_jiffies) {
+            why = "checkpoint from an earlier boot";
+            return false;
+        }
+        if (h->num_cpus != now.num_cpus || h->clk_tck != (uint32_t)sysconf(_SC_CLK_TCK) ||
+            h->page_kb != (uint32_t)(sysconf(_SC_PAGESIZE) / 1024)) {
+            why = "checkpoint from a different CPU/page setup";
+            return false;
+        }
+        if (age > max_age_s) {
+            why = "checkpoint too old";
+            return false;
+        }
+        const Proc *r = (const Proc *)(base + sizeof(Header));
+        const float *floats = (const float *)(r + h->nprocs);
+        const char *str = (const char *)(floats + h->hist_floats);
+        bool with_hist = h->depth == hist.depth() && h->num_metrics == MetricHistory::NUM_METRICS;
+        snap.total_jiffies = h->total_jiffies;
+        snap.idle_jiffies = h->idle_jiffies;
+        snap.task_jiffies = snap.irq_jiffies = snap.steal_jiffies = 0;
+        snap.mem_total_kb = h->mem_total_kb;
+        snap.mem_free_kb = h->mem_free_kb;
+        snap.mem_available_kb = h->mem_available_kb;
+        snap.num_cpus = h->num_cpus;
+        prev.clear();
+        for (uint32_t i = 0; i < h->nprocs; ++i, ++r) {
+            auto it = live.find(ProcKey{r->pid, r->starttime});
+            if (it == live.end() || r->cmd_off >= h->strings_bytes ||
+                r->hist_off + (uint64_t)h->num_metrics * r->hist_count > h->hist_floats)
+                continue;
+            ProcInfo p = it->second;
+            p.utime = r->utime;
+            p.stime = r->stime;
+            p.cutime = r->cutime;
+            p.cstime = r->cstime;
+            p.total_time = r->total_time;
+            p.io_read_bytes = r->io_read_bytes;
+            p.io_write_bytes = r->io_write_bytes;
+            p.minflt = r->minflt;
+            p.majflt = r->majflt;
+            p.rss = r->rss;
+            p.peak_rss = r->peak_rss;
+            p.cmd.assign(str + r->cmd_off, strnlen(str + r->cmd_off, h->strings_bytes - r->cmd_off));
+            for (int w = 0; w < CpuEwma::NUM_WINDOWS; ++w) p.cpu_avg[w] = r->cpu_avg[w];
+            table.assign(p, 0);
+            if (p.slot != NO_SLOT) {
+                ewma.restore(p.slot, p.cpu_avg);
+                hist.reset(p.slot);
+                const float *col = floats + r->hist_off;
+                for (uint32_t k = 0; with_hist && k < r->hist_count; ++k) {
+                    float vals[MetricHistory::NUM_METRICS];
+                    for (int mt = 0; mt < MetricHistory::NUM_METRICS; ++mt) vals[mt] = col[mt * r->hist_count + k];
+                    hist.push(p.slot, vals);
+                }
+            }
+            prev[p.key()] = p;
+        }
+        return true;
+    }
+};
+
+// Frame recording: FILE holds a header followed by one self-contained frame
+// per tick (fixed-size records plus that frame's command strings), and
+// FILE.idx holds one (time, offset) entry per frame so readers can seek to a
+// time range and split it into chunks without parsing frames.
+struct RecFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_cpus;
+    uint32_t page_kb;
+    uint32_t clk_tck;
+    uint64_t mem_total_kb;
+};
+
+struct RecFrameHeader {
+    uint32_t magic;
+    uint32_t nprocs;
+    uint64_t time_ns;
+    double interval_s;
+    uint64_t total_jiffies;
+    uint64_t mem_available_kb;
+    uint32_t strings_bytes;
+    uint32_t pad;
+};
+
+struct RecProc {
+    int32_t pid;
+    int32_t ppid;
+    uint64_t starttime;
+    uint64_t own_ticks;
+    uint64_t child_ticks;
+    uint64_t io_bytes;
+    uint64_t faults;
+    int64_t rss_pages;
+    float cpu_percent;
+    float mem_percent;
+    float io_kb_per_s;
+    float faults_per_s;
+    uint32_t cmd_off;
+    uint32_t pad;
+};
+
+struct RecIndexEntry {
+    uint64_t time_ns;
+    uint64_t offset;
+};
+
+static const uint32_t REC_FRAME_MAGIC = 0x4d415246; // "FRAM"
+
+class Recorder {
+public:
+    ~Recorder() { close(); }
+
+    bool open(const std::string &path, const SystemSnapshot &snap) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        idx_fd_ = ::open((path + ".idx").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0 || idx_fd_ < 0) { close(); return false; }
+        struct stat st;
+        fstat(fd_, &st);
+        offset_ = (uint64_t)st.st_size;
+        if (offset_ == 0) {
+            RecFileHeader h;
+            memset(&h, 0, sizeof(h));
+            memcpy(h.magic, "SYSMREC1", 8);
+            h.version = 1;
+            h.num_cpus = (uint32_t)snap.num_cpus;
+            h.page_kb = (uint32_t)(sysconf(_SC_PAGESIZE) / 1024);
+            h.clk_tck = (uint32_t)sysconf(_SC_CLK_TCK);
+            h.mem_total_kb = snap.mem_total_kb;
+            if (write(fd_, &h, sizeof(h)) != (ssize_t)sizeof(h)) { close(); return false; }
+            offset_ = sizeof(h);
+        }
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        if (idx_fd_ >= 0) ::close(idx_fd_);
+        fd_ = idx_fd_ = -1;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    void write_frame(uint64_t time_ns, double interval_s, const SystemSnapshot &snap, const ProcMap &procs) {
+        buf_.clear();
+        strings_.clear();
+        buf_.resize(sizeof(RecFrameHeader) + procs.size() * sizeof(RecProc));
+        RecFrameHeader *fh = (RecFrameHeader *)buf_.data();
+        memset(fh, 0, sizeof(*fh));
+        fh->magic = REC_FRAME_MAGIC;
+        fh->nprocs = (uint32_t)procs.size();
+        fh->time_ns = time_ns;
+        fh->interval_s = interval_s;
+        fh->total_jiffies = snap.total_jiffies;
+        fh->mem_available_kb = snap.mem_available_kb;
+        RecProc *r = (RecProc *)(buf_.data() + sizeof(RecFrameHeader));
+        for (auto &kv : procs) {
+            const ProcInfo &p = kv.second;
+            memset(r, 0, sizeof(*r));
+            r->pid = p.pid;
+            r->ppid = p.ppid;
+            r->starttime = p.starttime;
+            r->own_ticks = (uint64_t)p.utime + p.stime;
+            r->child_ticks = (uint64_t)p.cutime + p.cstime;
+            r->io_bytes = p.io_read_bytes + p.io_write_bytes;
+            r->faults = (uint64_t)p.minflt + p.majflt;
+            r->rss_pages = p.rss;
+            r->cpu_percent = (float)p.cpu_percent;
+            r->mem_percent = (float)p.mem_percent;
+            r->io_kb_per_s = (float)p.io_kb_per_s;
+            r->faults_per_s = (float)p.faults_per_s;
+            r->cmd_off = (uint32_t)strings_.size();
+            strings_.append(p.cmd.c_str(), p.cmd.size() + 1);
+            ++r;
+        }
+        fh = (RecFrameHeader *)buf_.data();
+        fh->strings_bytes = (uint32_t)strings_.size();
+        buf_.insert(buf_.end(), strings_.begin(), strings_.end());
+        if (write(fd_, buf_.data(), buf_.size()) != (ssize_t)buf_.size()) return;
+        RecIndexEntry e{time_ns, offset_};
+        if (write(idx_fd_, &e, sizeof(e)) != (ssize_t)sizeof(e)) return;
+        offset_ += buf_.size();
+    }
+
+private:
+    int fd_{-1};
+    int idx_fd_{-1};
+    uint64_t offset_{0};
+    std::vector<char> buf_;
+    std::string strings_;
+};
+
+// Read-only view of a recording and its index, both mmap'd.
+class RecordingReader {
+public:
+    ~RecordingReader() { close(); }
+
+    bool open(const std::string &path) {
+        if (!map(path, data_, data_size_) || !map(path + ".idx", idx_, idx_size_)) { close(); return false; }
+        if (data_size_ < sizeof(RecFileHeader) || memcmp(data_, "SYSMREC1", 8) != 0) { close(); return false; }
+        return true;
+    }
+
+    void close() {
+        if (data_) munmap(data_, data_size_);
+        if (idx_) munmap(idx_, idx_size_);
+        data_ = idx_ = nullptr;
+        data_size_ = idx_size_ = 0;
+    }
+
+    const RecFileHeader &header() const { return *(const RecFileHeader *)data_; }
+    size_t frames() const { return idx_size_ / sizeof(RecIndexEntry); }
+    const RecIndexEntry &entry(size_t i) const { return ((const RecIndexEntry *)idx_)[i]; }
+
+    // First frame with time >= t_ns (binary search over the index).
+    size_t lower_bound(uint64_t t_ns) const {
+        size_t lo = 0, hi = frames();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (entry(mid).time_ns < t_ns) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Calls f(frame header, records, strings) for frames [first, last).
+    template <typename F>
+    void scan(size_t first, size_t last, F f) const {
+        for (size_t i = first; i < last && i < frames(); ++i) {
+            uint64_t off = entry(i).offset;
+            if (off + sizeof(RecFrameHeader) > data_size_) break;
+            const RecFrameHeader *fh = (const RecFrameHeader *)(data_ + off);
+            size_t body = (size_t)fh->nprocs * sizeof(RecProc);
+            if (fh->magic != REC_FRAME_MAGIC || off + sizeof(*fh) + body + fh->strings_bytes > data_size_) break;
+            const RecProc *recs = (const RecProc *)(data_ + off + sizeof(*fh));
+            const char *strings = data_ + off + sizeof(*fh) + body;
+            f(*fh, recs, strings);
+        }
+    }
+
+private:
+    static bool map(const std::string &path, char *&out, size_t &size) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0) { ::close(fd); return false; }
+        void *m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) return false;
+        madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+        out = (char *)m;
+        size = (size_t)st.st_size;
+        return true;
+    }
+
+    char *data_{nullptr};
+    char *idx_{nullptr};
+    size_t data_size_{0};
+    size_t idx_size_{0};
+};
+
+struct TraceSample {
+    ProcKey key;
+    const char *cmd;
+    float cpu_percent;
+    float rss_kb;
+    float io_kb_per_s;
+};
+
+// Streams samples as a Chrome JSON trace (loadable in Perfetto and
+// chrome://tracing): per-process counter tracks for CPU%, RSS and I/O plus
+// instant events for process start and exit. Only the previous frame's
+// processes are kept in memory, so arbitrarily long inputs convert in
+// bounded memory. A recycled pid gets a fresh trace pid so two processes
+// never share a track.
+class TraceExporter {
+public:
+    ~TraceExporter() { close(); }
+
+    bool open(const std::string &path) {
+        close();
+        f_ = fopen(path.c_str(), "w");
+        if (!f_) return false;
+        // Per exporter: the stream uses it until fclose.
+        if (!buf_) buf_.reset(new char[BUF_BYTES]);
+        setvbuf(f_, buf_.get(), _IOFBF, BUF_BYTES);
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f_);
+        first_event_ = true;
+        frames_ = 0;
+        return true;
+    }
+
+    void close() {
+        if (!f_) return;
+        fputs("\n]}\n", f_);
+        fclose(f_);
+        f_ = nullptr;
+        live_.clear();
+    }
+
+    bool is_open() const { return f_ != nullptr; }
+
+    void frame(uint64_t time_ns, const std::vector<TraceSample> &samples) {
+        uint64_t ts = time_ns / 1000;
+        std::unordered_map<ProcKey, Track, ProcKeyHash> next;
+        next.reserve(samples.size());
+        for (const TraceSample &sm : samples) {
+            auto it = live_.find(sm.key);
+            Track t;
+            if (it != live_.end()) {
+                t = it->second;
+            } else {
+                t.trace_pid = trace_pid(sm.key.pid);
+                begin_event();
+                fprintf(f_, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", t.trace_pid);
+                json_string(sm.cmd);
+                fprintf(f_, ",\"pid\":%d,\"starttime\":%llu}}", sm.key.pid, sm.key.starttime);
+                if (frames_ > 0) instant(t.trace_pid, "start", ts);
+            }
+            counter(t.trace_pid, "CPU%", ts, sm.cpu_percent, t.cpu);
+            counter(t.trace_pid, "RSS KB", ts, sm.rss_kb, t.rss);
+            counter(t.trace_pid, "IO KB/s", ts, sm.io_kb_per_s, t.io);
+            next[sm.key] = t;
+        }
+        for (auto &kv : live_)
+            if (!next.count(kv.first)) instant(kv.second.trace_pid, "exit", ts);
+        live_.swap(next);
+        frames_++;
+    }
+
+private:
+    struct Track {
+        int trace_pid{0};
+        float cpu{-1.0f}, rss{-1.0f}, io{-1.0f};
+    };
+
+    int trace_pid(int pid) {
+        if (used_pids_.insert(pid).second) return pid;
+        return next_alias_++;
+    }
+
+    void begin_event() {
+        if (!first_event_) fputs(",\n", f_);
+        first_event_ = false;
+    }
+
+    void counter(int tpid, const char *name, uint64_t ts, float v, float &last) {
+        if (std::fabs(v - last) < 0.005f) return;
+        last = v;
+        begin_event();
+        // One of these per process and metric per tick, so no printf.
+        char buf[160], *p = buf;
+        p = stpcpy(stpcpy(p, "{\"name\":\""), name);
+        p = put_int(stpcpy(p, "\",\"ph\":\"C\",\"ts\":"), (long long)ts);
+        p = put_int(stpcpy(p, ",\"pid\":"), tpid);
+        p = put_fixed(stpcpy(p, ",\"args\":{\"value\":"), v, 2);
+        p = stpcpy(p, "}}");
+        fwrite(buf, 1, p - buf, f_);
+    }
+
+    void instant(int tpid, const char *name, uint64_t ts) {
+        begin_event();
+        fprintf(f_, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%llu,\"pid\":%d,\"tid\":%d}",
+                name, (unsigned long long)ts, tpid, tpid);
+    }
+
+    void json_string(const char *str) {
+        fputc('"', f_);
+        for (const unsigned char *c = (const unsigned char *)str; *c; ++c) {
+            if (*c == '"' || *c == '\\') { fputc('\\', f_); fputc(*c, f_); }
+            else if (*c < 0x20) fprintf(f_, "\\u%04x", *c);
+            else fputc(*c, f_);
+        }
+        fputc('"', f_);
+    }
+
+    static const size_t BUF_BYTES = 1 << 16;
+    std::unique_ptr<char[]> buf_;
+    FILE *f_{nullptr};
+    bool first_event_{true};
+    uint64_t frames_{0};
+    int next_alias_{1 << 22};
+    std::unordered_map<ProcKey, Track, ProcKeyHash> live_;
+    std::unordered_set<int> used_pids_;
+};
+
+static std::vector<TraceSample> trace_samples(const ProcMap &procs) {
+    static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+    std::vector<TraceSample> out;
+    out.reserve(procs.size());
+    for (auto &kv : procs) {
+        const ProcInfo &p = kv.second;
+        out.push_back(TraceSample{kv.first, p.cmd.c_str(), (float)p.cpu_percent, (float)(p.rss * page_size_kb),
+                                  (float)p.io_kb_per_s});
+    }
+    return out;
+}
+
+// Converts a recording to a trace one frame at a time.
+static int run_export_trace(int argc, char **argv) {
+    if (argc < 3) return 2;
+    RecordingReader rec;
+    if (!rec.open(argv[1])) {
+        fprintf(stderr, "%s: not a recording\n", argv[1]);
+        return 1;
+    }
+    TraceExporter out;
+    if (!out.open(argv[2])) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    long page_kb = rec.header().page_kb;
+    std::vector<TraceSample> samples;
+    rec.scan(0, rec.frames(), [&](const RecFrameHeader &fh, const RecProc *r, const char *strings) {
+        samples.clear();
+        for (uint32_t i = 0; i < fh.nprocs; ++i)
+            samples.push_back(TraceSample{ProcKey{r[i].pid, r[i].starttime}, strings + r[i].cmd_off, r[i].cpu_percent,
+                                          (float)(r[i].rss_pages * page_kb), r[i].io_kb_per_s});
+        out.frame(fh.time_ns, samples);
+    });
+    out.close();
+    return 0;
+}
+
+// Per-tick process table as one array per column, rows appended tick by
+// tick. cmd and user are dictionary indices into append-only string tables.
+struct ProcColumns {
+    std::vector<int64_t> time_ns;
+    std::vector<int32_t> pid;
+    std::vector<uint64_t> starttime;
+    std::vector<double> cpu_percent;
+    std::vector<double> mem_percent;
+    std::vector<int64_t> rss_kb;
+    std::vector<double> io_kb_per_s;
+    std::vector<double> faults_per_s;
+    std::vector<int32_t> user;
+    std::vector<int32_t> cmd;
+
+    size_t rows() const { return pid.size(); }
+
+    void clear() {
+        time_ns.clear(); pid.clear(); starttime.clear(); cpu_percent.clear(); mem_percent.clear();
+        rss_kb.clear(); io_kb_per_s.clear(); faults_per_s.clear(); user.clear(); cmd.clear();
+    }
+};
+
+class StringDict {
+public:
+    int32_t index(const std::string &v) {
+        auto it = index_.find(v);
+        if (it != index_.end()) return it->second;
+        int32_t i = (int32_t)offsets_.size() - 1;
+        index_.emplace(v, i);
+        data_ += v;
+        offsets_.push_back((int32_t)data_.size());
+        return i;
+    }
+    size_t size() const { return offsets_.size() - 1; }
+    // Entries [from, size()) as Arrow utf8 offsets rebased to zero and bytes.
+    void slice(size_t from, std::vector<int32_t> &offsets, const char *&bytes, size_t &nbytes) const {
+        offsets.clear();
+        for (size_t i = from; i < offsets_.size(); ++i) offsets.push_back(offsets_[i] - offsets_[from]);
+        bytes = data_.data() + offsets_[from];
+        nbytes = (size_t)(offsets_.back() - offsets_[from]);
+    }
+private:
+    std::unordered_map<std::string, int32_t> index_;
+    std::string data_;
+    std::vector<int32_t> offsets_{0};
+};
+
+// Minimal FlatBuffers builder, enough for Arrow IPC metadata. Like the
+// reference implementation it fills the buffer back to front, so every
+// offset is the distance from the end of the buffer.
+class FlatBuilder {
+public:
+    size_t size() const { return buf_.size(); }
+
+    void prep(size_t align, size_t additional) {
+        minalign_ = std::max(minalign_, align);
+        size_t pad = (~(buf_.size() + additional) + 1) & (align - 1);
+        buf_.insert(buf_.end(), pad, 0);
+    }
+
+    template <typename T> void push(T v) {
+        prep(sizeof(T), 0);
+        const uint8_t *b = (const uint8_t *)&v;
+        for (size_t i = sizeof(T); i > 0; --i) buf_.push_back(b[i - 1]);
+    }
+
+    void push_offset(uint32_t target) {
+        prep(4, 0);
+        push<uint32_t>((uint32_t)(size() + 4 - target));
+    }
+
+    uint32_t string(const std::string &v) {
+        prep(4, v.size() + 1);
+        buf_.push_back(0);
+        for (size_t i = v.size(); i > 0; --i) buf_.push_back((uint8_t)v[i - 1]);
+        push<uint32_t>((uint32_t)v.size());
+        return (uint32_t)size();
+    }
+
+    // Vector of 16-byte structs made of two int64 fields (Arrow Buffer/FieldNode).
+    uint32_t struct_vector(const std::vector<std::pair<int64_t, int64_t>> &v) {
+        prep(4, v.size() * 16);
+        prep(8, v.size() * 16);
+        for (size_t i = v.size(); i > 0; --i) {
+            push<int64_t>(v[i - 1].second);
+            push<int64_t>(v[i - 1].first);
+        }
+        push<uint32_t>((uint32_t)v.size());
+        return (uint32_t)size();
+    }
+
+    uint32_t offset_vector(const std::vector<uint32_t> &v) {
+        prep(4, v.size() * 4);
+        for (size_t i = v.size(); i > 0; --i) push_offset(v[i - 1]);
+        push<uint32_t>((uint32_t)v.size());
+        return (uint32_t)size();
+    }
+
+    void start_table() {
+        fields_.clear();
+        table_start_ = size();
+    }
+    template <typename T> void add(uint16_t id, T v) {
+        push<T>(v);
+        fields_.emplace_back(id, (uint32_t)size());
+    }
+    void add_offset(uint16_t id, uint32_t target) {
+        push_offset(target);
+        fields_.emplace_back(id, (uint32_t)size());
+    }
+    uint32_t end_table() {
+        push<int32_t>(0);
+        uint32_t table = (uint32_t)size();
+        uint16_t nfields = 0;
+        for (auto &f : fields_) nfields = std::max<uint16_t>(nfields, (uint16_t)(f.first + 1));
+        std::vector<uint16_t> slots(nfields, 0);
+        for (auto &f : fields_) slots[f.first] = (uint16_t)(table - f.second);
+        for (size_t i = nfields; i > 0; --i) push<uint16_t>(slots[i - 1]);
+        push<uint16_t>((uint16_t)(table - table_start_));
+        push<uint16_t>((uint16_t)(4 + 2 * nfields));
+        int32_t soff = (int32_t)(size() - table);
+        uint8_t *at = &buf_[table - 4];
+        // buf_ is reversed; write the little-endian soffset reversed too.
+        for (int i = 0; i < 4; ++i) at[3 - i] = (uint8_t)((uint32_t)soff >> (8 * i));
+        return table;
+    }
+
+    std::vector<uint8_t> finish(uint32_t root) {
+        prep(std::max<size_t>(minalign_, 8), 4);
+        push_offset(root);
+        return std::vector<uint8_t>(buf_.rbegin(), buf_.rend());
+    }
+
+private:
+    std::vector<uint8_t> buf_;
+    size_t minalign_{1};
+    size_t table_start_{0};
+    std::vector<std::pair<uint16_t, uint32_t>> fields_;
+};
+
+// Arrow IPC stream writer for ProcColumns. Numeric columns go straight from
+// the column vectors to the file with one writev per batch; cmd and user are
+// dictionary encoded, with delta dictionary batches carrying only strings
+// first seen since the previous batch. Readable by pyarrow.ipc.open_stream,
+// pandas and DuckDB.
+class ArrowWriter {
+public:
+    ~ArrowWriter() { close(); }
+
+    bool open(const std::string &path, size_t batch_ticks) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        batch_ticks_ = std::max<size_t>(1, batch_ticks);
+        write_schema();
+        return true;
+    }
+
+    void close() {
+        if (fd_ < 0) return;
+        flush();
+        uint32_t eos[2] = {0xFFFFFFFFu, 0};
+        ssize_t r = write(fd_, eos, sizeof(eos));
+        (void)r;
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    void append(uint64_t time_ns, const ProcMap &procs) {
+        static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+        for (auto &kv : procs) {
+            const ProcInfo &p = kv.second;
+            cols_.time_ns.push_back((int64_t)time_ns);
+            cols_.pid.push_back(p.pid);
+            cols_.starttime.push_back(p.starttime);
+            cols_.cpu_percent.push_back(p.cpu_percent);
+            cols_.mem_percent.push_back(p.mem_percent);
+            cols_.rss_kb.push_back(p.rss * page_size_kb);
+            cols_.io_kb_per_s.push_back(p.io_kb_per_s);
+            cols_.faults_per_s.push_back(p.faults_per_s);
+            cols_.user.push_back(users_.index(p.user));
+            cols_.cmd.push_back(cmds_.index(p.cmd));
+        }
+        if (++ticks_ >= batch_ticks_) flush();
+    }
+
+    void flush() {
+        if (fd_ < 0 || cols_.rows() == 0) return;
+        write_dictionary(USER_DICT, users_, users_sent_);
+        write_dictionary(CMD_DICT, cmds_, cmds_sent_);
+        Body body;
+        body.column(cols_.time_ns);
+        body.column(cols_.pid);
+        body.column(cols_.starttime);
+        body.column(cols_.cpu_percent);
+        body.column(cols_.mem_percent);
+        body.column(cols_.rss_kb);
+        body.column(cols_.io_kb_per_s);
+        body.column(cols_.faults_per_s);
+        body.column(cols_.user);
+        body.column(cols_.cmd);
+        FlatBuilder fb;
+        uint32_t rb = record_batch(fb, (int64_t)cols_.rows(), body);
+        write_message(fb, MSG_RECORD_BATCH, rb, body);
+        cols_.clear();
+        ticks_ = 0;
+    }
+
+private:
+    enum { MSG_SCHEMA = 1, MSG_DICTIONARY_BATCH = 2, MSG_RECORD_BATCH = 3 };
+    enum { TYPE_INT = 2, TYPE_FLOAT = 3, TYPE_UTF8 = 5, TYPE_TIMESTAMP = 10 };
+    enum { USER_DICT = 0, CMD_DICT = 1 };
+
+    // Body buffers as iovecs pointing into the caller's memory, each padded to 8 bytes.
+    struct Body {
+        std::vector<struct iovec> iov;
+        std::vector<std::pair<int64_t, int64_t>> buffers;
+        std::vector<std::pair<int64_t, int64_t>> nodes;
+        int64_t length{0};
+
+        void buffer(const void *p, size_t n) {
+            static const uint64_t zeros = 0;
+            buffers.emplace_back(length, (int64_t)n);
+            if (n) iov.push_back(iovec{const_cast<void *>(p), n});
+            size_t pad = (8 - n % 8) % 8;
+            if (pad) iov.push_back(iovec{(void *)&zeros, pad});
+            length += (int64_t)(n + pad);
+        }
+        template <typename T> void column(const std::vector<T> &v) {
+            nodes.emplace_back((int64_t)v.size(), 0);
+            buffer(nullptr, 0);  // no validity bitmap, nothing is null
+            buffer(v.data(), v.size() * sizeof(T));
+        }
+    };
+
+    uint32_t int_type(FlatBuilder &fb, int bits, bool is_signed) {
+        fb.start_table();
+        fb.add<int32_t>(0, bits);
+        fb.add<uint8_t>(1, is_signed);
+        return fb.end_table();
+    }
+
+    uint32_t field(FlatBuilder &fb, const char *name, uint8_t type_type, int bits, bool is_signed, int dict_id = -1) {
+        uint32_t n = fb.string(name);
+        uint32_t type;
+        if (type_type == TYPE_INT) {
+            type = int_type(fb, bits, is_signed);
+        } else if (type_type == TYPE_FLOAT) {
+            fb.start_table();
+            fb.add<int16_t>(0, 2);  // DOUBLE
+            type = fb.end_table();
+        } else if (type_type == TYPE_TIMESTAMP) {
+            fb.start_table();
+            fb.add<int16_t>(0, 3);  // NANOSECOND
+            type = fb.end_table();
+        } else {
+            fb.start_table();
+            type = fb.end_table();
+        }
+        uint32_t dict = 0;
+        if (dict_id >= 0) {
+            uint32_t idx = int_type(fb, 32, true);
+            fb.start_table();
+            fb.add<int64_t>(0, dict_id);
+            fb.add_offset(1, idx);
+            dict = fb.end_table();
+        }
+        uint32_t children = fb.offset_vector({});
+        fb.start_table();
+        fb.add_offset(0, n);
+        fb.add<uint8_t>(1, 0);
+        fb.add<uint8_t>(2, type_type);
+        fb.add_offset(3, type);
+        if (dict_id >= 0) fb.add_offset(4, dict);
+        fb.add_offset(5, children);
+        return fb.end_table();
+    }
+
+    void write_schema() {
+        FlatBuilder fb;
+        std::vector<uint32_t> fields = {
+            field(fb, "time", TYPE_TIMESTAMP, 0, false),
+            field(fb, "pid", TYPE_INT, 32, true),
+            field(fb, "starttime", TYPE_INT, 64, false),
+            field(fb, "cpu_percent", TYPE_FLOAT, 0, false),
+            field(fb, "mem_percent", TYPE_FLOAT, 0, false),
+            field(fb, "rss_kb", TYPE_INT, 64, true),
+            field(fb, "io_kb_per_s", TYPE_FLOAT, 0, false),
+            field(fb, "faults_per_s", TYPE_FLOAT, 0, false),
+            field(fb, "user", TYPE_UTF8, 0, false, USER_DICT),
+            field(fb, "cmd", TYPE_UTF8, 0, false, CMD_DICT),
+        };
+        uint32_t vec = fb.offset_vector(fields);
+        fb.start_table();
+        fb.add<int16_t>(0, 0);  // little endian
+        fb.add_offset(1, vec);
+        uint32_t schema = fb.end_table();
+        write_message(fb, MSG_SCHEMA, schema, Body());
+    }
+
+    uint32_t record_batch(FlatBuilder &fb, int64_t length, const Body &body) {
+        uint32_t buffers = fb.struct_vector(body.buffers);
+        uint32_t nodes = fb.struct_vector(body.nodes);
+        fb.start_table();
+        fb.add<int64_t>(0, length);
+        fb.add_offset(1, nodes);
+        fb.add_offset(2, buffers);
+        return fb.end_table();
+    }
+
+    void write_dictionary(int id, const StringDict &dict, size_t &sent) {
+        if (dict.size() == sent) return;
+        std::vector<int32_t> offsets;
+        const char *bytes;
+        size_t nbytes;
+        dict.slice(sent, offsets, bytes, nbytes);
+        Body body;
+        body.nodes.emplace_back((int64_t)(dict.size() - sent), 0);
+        body.buffer(nullptr, 0);
+        body.buffer(offsets.data(), offsets.size() * sizeof(int32_t));
+        body.buffer(bytes, nbytes);
+        FlatBuilder fb;
+        uint32_t rb = record_batch(fb, (int64_t)(dict.size() - sent), body);
+        fb.start_table();
+        fb.add<int64_t>(0, id);
+        fb.add_offset(1, rb);
+        fb.add<uint8_t>(2, sent > 0);  // isDelta
+        uint32_t db = fb.end_table();
+        write_message(fb, MSG_DICTIONARY_BATCH, db, body);
+        sent = dict.size();
+    }
+
+    void write_message(FlatBuilder &fb, uint8_t header_type, uint32_t header, const Body &body) {
+        fb.start_table();
+        fb.add<int64_t>(3, body.length);
+        fb.add_offset(2, header);
+        fb.add<int16_t>(0, 4);  // MetadataVersion V5
+        fb.add<uint8_t>(1, header_type);
+        std::vector<uint8_t> meta = fb.finish(fb.end_table());
+        size_t padded = (meta.size() + 7) / 8 * 8;
+        meta.resize(padded, 0);
+        uint32_t prefix[2] = {0xFFFFFFFFu, (uint32_t)padded};
+        std::vector<struct iovec> iov;
+        iov.push_back(iovec{prefix, sizeof(prefix)});
+        iov.push_back(iovec{meta.data(), meta.size()});
+        iov.insert(iov.end(), body.iov.begin(), body.iov.end());
+        for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+            if (writev(fd_, iov.data() + i, (int)std::min<size_t>(IOV_MAX, iov.size() - i)) < 0) return;
+        }
+    }
+
+    int fd_{-1};
+    size_t batch_ticks_{1};
+    size_t ticks_{0};
+    ProcColumns cols_;
+    StringDict users_, cmds_;
+    size_t users_sent_{0}, cmds_sent_{0};
+};
+
+// The current tick's metrics scattered by process slot, one float column per
+// metric plus a 0/1 presence mask, so per-process detectors can run as
+// straight loops over contiguous arrays. Absent slots hold NaN, which fails
+// every comparison, so threshold scans need not consult the mask. Columns
+// are padded to a multiple of BLOCK so scans can work in fixed-size blocks
+// without a scalar tail.
+class SlotMetrics {
+public:
+    enum Metric { CPU, MEM, RSS_KB, RSS_RATE, IO_KBS, FAULTS, AVG1, AVG10, AVG60, NUM_METRICS };
+    static const size_t BLOCK = 64;
+
+    void reset(uint32_t slot) {
+        ensure((size_t)slot + 1);
+        prev_present_[slot] = 0.0f;
+    }
+
+    void update(const ProcMap &procs, size_t capacity, double dt_s) {
+        static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+        ensure(capacity);
+        std::fill(present.begin(), present.end(), 0.0f);
+        for (int m = 0; m < NUM_METRICS; ++m) std::fill(col[m].begin(), col[m].end(), NAN);
+        for (auto &kv : procs) {
+            const ProcInfo &p = kv.second;
+            if (p.slot == NO_SLOT) continue;
+            uint32_t i = p.slot;
+            float rss_kb = (float)(p.rss * page_size_kb);
+            present[i] = 1.0f;
+            info[i] = &p;
+            col[CPU][i] = (float)p.cpu_percent;
+            col[MEM][i] = (float)p.mem_percent;
+            col[RSS_RATE][i] = prev_present_[i] > 0 && dt_s > 0 ? (float)((rss_kb - prev_rss_kb_[i]) / dt_s) : 0.0f;
+            col[RSS_KB][i] = rss_kb;
+            prev_rss_kb_[i] = rss_kb;
+            col[IO_KBS][i] = (float)p.io_kb_per_s;
+            col[FAULTS][i] = (float)p.faults_per_s;
+            col[AVG1][i] = (float)p.cpu_avg[0];
+            col[AVG10][i] = (float)p.cpu_avg[1];
+            col[AVG60][i] = (float)p.cpu_avg[2];
+        }
+        prev_present_ = present;
+    }
+
+    size_t size() const { return present.size(); }
+
+    std::vector<float> present;
+    std::vector<const ProcInfo *> info;  // valid for the current tick only
+    std::vector<float> col[NUM_METRICS];
+
+private:
+    void ensure(size_t n) {
+        if (n <= present.size()) return;
+        n = (n + BLOCK - 1) / BLOCK * BLOCK;
+        present.resize(n, 0.0f);
+        prev_present_.resize(n, 0.0f);
+        prev_rss_kb_.resize(n, 0.0f);
+        info.resize(n, nullptr);
+        for (int m = 0; m < NUM_METRICS; ++m) col[m].resize(n, NAN);
+    }
+
+    std::vector<float> prev_present_;
+    std::vector<float> prev_rss_kb_;
+};
+
+static const char *slot_metric_names[SlotMetrics::NUM_METRICS] = {
+    "cpu", "mem", "rss", "rss_rate", "io", "faults", "avg1", "avg10", "avg60"};
+
+// Parses "90", "100MB", "100MB/min", "5k/s". Sizes are in KB, rates per second.
+static bool parse_quantity(const std::string &v, float &out) {
+    char *end = nullptr;
+    double x = strtod(v.c_str(), &end);
+    if (end == v.c_str()) return false;
+    std::string unit = end;
+    std::string per;
+    size_t slash = unit.find('/');
+    if (slash != std::string::npos) {
+        per = unit.substr(slash + 1);
+        unit = unit.substr(0, slash);
+    }
+    for (auto &c : unit) c = (char)tolower(c);
+    if (unit == "k" || unit == "kb") x *= 1.0;
+    else if (unit == "m" || unit == "mb") x *= 1024.0;
+    else if (unit == "g" || unit == "gb") x *= 1024.0 * 1024.0;
+    else if (!unit.empty() && unit != "%") return false;
+    if (per == "min") x /= 60.0;
+    else if (per == "h") x /= 3600.0;
+    else if (!per.empty() && per != "s") return false;
+    out = (float)x;
+    return true;
+}
+
+static bool parse_duration(const std::string &v, float &out) {
+    char *end = nullptr;
+    double x = strtod(v.c_str(), &end);
+    if (end == v.c_str()) return false;
+    std::string unit = end;
+    if (unit == "m" || unit == "min") x *= 60.0;
+    else if (unit == "h") x *= 3600.0;
+    else if (!unit.empty() && unit != "s") return false;
+    out = (float)x;
+    return true;
+}
+
+// Per-tick alert rules such as "hot: cpu > 90 for 60s clear 80" or
+// "leak: rss_rate > 100MB/min for 5m". Each rule is compiled to a metric
+// column, comparison and thresholds. Evaluation is a SIMD scan of that
+// column for slots past the looser of the two thresholds; only those slots
+// and the few already pending or firing touch per-rule state, so the cost
+// is one compare per process per rule. A rule fires once the condition has
+// held for its duration and clears only when the value crosses the clear
+// threshold.
+class AlertEngine {
+public:
+    enum Op { GT, GE, LT, LE };
+
+    bool add_rule(const std::string &text, std::string &err) {
+        std::istringstream ss(text);
+        std::vector<std::string> t;
+        std::string w;
+        while (ss >> w) t.push_back(w);
+        Rule r;
+        r.text = text;
+        size_t i = 0;
+        if (!t.empty() && t[0].back() == ':') {
+            r.name = t[0].substr(0, t[0].size() - 1);
+            i = 1;
+        }
+        if (t.size() < i + 3) { err = "expected: [name:] metric op value [for duration] [clear value]"; return false; }
+        r.metric = -1;
+        for (int m = 0; m < SlotMetrics::NUM_METRICS; ++m)
+            if (t[i] == slot_metric_names[m]) r.metric = m;
+        if (r.metric < 0) { err = "unknown metric " + t[i]; return false; }
+        if (r.name.empty()) r.name = t[i];
+        const std::string &op = t[i + 1];
+        if (op == ">") r.op = GT;
+        else if (op == ">=") r.op = GE;
+        else if (op == "<") r.op = LT;
+        else if (op == "<=") r.op = LE;
+        else { err = "unknown operator " + op; return false; }
+        if (!parse_quantity(t[i + 2], r.threshold)) { err = "bad value " + t[i + 2]; return false; }
+        r.clear = r.threshold;
+        for (i += 3; i < t.size(); i += 2) {
+            if (i + 1 >= t.size()) { err = "missing value after " + t[i]; return false; }
+            if (t[i] == "for") {
+                if (!parse_duration(t[i + 1], r.for_s)) { err = "bad duration " + t[i + 1]; return false; }
+            } else if (t[i] == "clear") {
+                if (!parse_quantity(t[i + 1], r.clear)) { err = "bad value " + t[i + 1]; return false; }
+            } else {
+                err = "unexpected " + t[i];
+                return false;
+            }
+        }
+        rules_.push_back(r);
+        return true;
+    }
+
+    bool add_rules_file(const std::string &path, std::string &err) {
+        std::ifstream f(path);
+        if (!f) { err = "cannot read " + path; return false; }
+        std::string line;
+        while (std::getline(f, line)) {
+            size_t hash = line.find('#');
+            if (hash != std::string::npos) line.erase(hash);
+            if (line.find_first_not_of(" \t") == std::string::npos) continue;
+            if (!add_rule(line, err)) return false;
+        }
+        return true;
+    }
+
+    // "stderr", "unix:/path/to/socket" (datagram) or a file to append to.
+    bool set_output(const std::string &spec) {
+        if (spec == "stderr") {
+            out_fd_ = 2;
+        } else if (spec.rfind("unix:", 0) == 0) {
+            out_fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            memset(&addr_, 0, sizeof(addr_));
+            addr_.sun_family = AF_UNIX;
+            snprintf(addr_.sun_path, sizeof(addr_.sun_path), "%s", spec.c_str() + 5);
+            use_socket_ = true;
+        } else {
+            out_fd_ = ::open(spec.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        }
+        return out_fd_ >= 0;
+    }
+
+    bool empty() const { return rules_.empty(); }
+    size_t firing() const { return firing_count_; }
+    double last_eval_us() const { return last_eval_us_; }
+
+    void reset(uint32_t slot) {
+        for (auto &st : state_) {
+            auto it = st.active.find(slot);
+            if (it == st.active.end()) continue;
+            st.count -= it->second.firing;
+            st.active.erase(it);
+        }
+    }
+
+    void evaluate(const SlotMetrics &m, const ProcTable &table, float dt_s, EventLog &log) {
+        auto t0 = std::chrono::steady_clock::now();
+        state_.resize(rules_.size());
+        firing_count_ = 0;
+        tick_++;
+        for (size_t r = 0; r < rules_.size(); ++r) {
+            const Rule &rule = rules_[r];
+            State &st = state_[r];
+            switch (rule.op) {
+            case GT: scan<GT>(m, rule, hits_); break;
+            case GE: scan<GE>(m, rule, hits_); break;
+            case LT: scan<LT>(m, rule, hits_); break;
+            case LE: scan<LE>(m, rule, hits_); break;
+            }
+            const float *v = m.col[rule.metric].data();
+            for (uint32_t i : hits_) {
+                bool cond = test(rule.op, v[i], rule.threshold);
+                bool hold = test(rule.op, v[i], rule.clear);
+                auto it = st.active.find(i);
+                if (it == st.active.end()) {
+                    if (!cond) continue;
+                    it = st.active.emplace(i, Active()).first;
+                }
+                Active &a = it->second;
+                a.seen = tick_;
+                a.held = cond ? a.held + dt_s : 0.0f;
+                bool f = (a.firing && hold) || (cond && a.held >= rule.for_s);
+                if (f != a.firing) {
+                    st.count += f ? 1 : -1;
+                    emit(rule, m, table, i, f, log);
+                }
+                a.firing = f;
+                if (!cond && !f) st.active.erase(it);
+            }
+            // Pending or firing slots that fell below both thresholds (or exited).
+            for (auto it = st.active.begin(); it != st.active.end();) {
+                if (it->second.seen == tick_) { ++it; continue; }
+                if (it->second.firing) {
+                    st.count--;
+                    emit(rule, m, table, it->first, false, log);
+                }
+                it = st.active.erase(it);
+            }
+            firing_count_ += (size_t)st.count;
+        }
+        last_eval_us_ = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+private:
+    struct Rule {
+        std::string name, text;
+        int metric{0};
+        Op op{GT};
+        float threshold{0}, clear{0}, for_s{0};
+    };
+    struct Active {
+        float held{0.0f};       // seconds the condition has been true
+        bool firing{false};
+        unsigned long long seen{0};
+    };
+    struct State {
+        std::unordered_map<uint32_t, Active> active;  // pending or firing slots only
+        int count{0};
+    };
+
+    // Four slots per step using GCC/Clang vector extensions (SSE2/NEON width),
+    // so the scan is SIMD even at -O2 without -march flags.
+    typedef float vf4 __attribute__((vector_size(16)));
+    typedef int32_t vi4 __attribute__((vector_size(16)));
+
+    static bool test(Op op, float a, float b) {
+        switch (op) {
+        case GT: return a > b;
+        case GE: return a >= b;
+        case LT: return a < b;
+        default: return a <= b;
+        }
+    }
+
+    template <int OP>
+    static inline vi4 compare(vf4 a, vf4 b) {
+        if (OP == GT) return a > b;
+        if (OP == GE) return a >= b;
+        if (OP == LT) return a < b;
+        return a <= b;
+    }
+
+    // Collects slots past the looser of threshold and clear (absent slots are NaN).
+    template <int OP>
+    static void scan(const SlotMetrics &m, const Rule &rule, std::vector<uint32_t> &hits) {
+        float loose = (OP == GT || OP == GE) ? std::min(rule.threshold, rule.clear) : std::max(rule.threshold, rule.clear);
+        const vf4 lv = loose - (vf4){};
+        const float *v = m.col[rule.metric].data();
+        const size_t n = m.size();
+        hits.clear();
+        for (size_t b = 0; b < n; b += SlotMetrics::BLOCK) {
+            vi4 any = (vi4){};
+            for (size_t i = b; i < b + SlotMetrics::BLOCK; i += 4) {
+                vf4 x;
+                memcpy(&x, v + i, sizeof(x));
+                any |= compare<OP>(x, lv);
+            }
+            if ((any[0] | any[1] | any[2] | any[3]) == 0) continue;
+            for (size_t i = b; i < b + SlotMetrics::BLOCK; ++i)
+                if (test((Op)OP, v[i], loose)) hits.push_back((uint32_t)i);
+        }
+    }
+
+    void emit(const Rule &rule, const SlotMetrics &m, const ProcTable &table, uint32_t slot, bool on, EventLog &log) {
+        char line[320];
+        const ProcInfo *p = m.present[slot] ? m.info[slot] : nullptr;
+        const ProcKey &k = table.key(slot);
+        snprintf(line, sizeof(line), "%s %s pid=%d starttime=%llu %s=%.2f cmd=%.60s [%s]", on ? "ALERT" : "CLEAR",
+                 rule.name.c_str(), k.pid, k.starttime, slot_metric_names[rule.metric],
+                 p ? m.col[rule.metric][slot] : 0.0f, p ? p->cmd.c_str() : "(exited)", rule.text.c_str());
+        log.push(line);
+        if (out_fd_ < 0) return;
+        std::string msg = clock_string() + " " + line + "\n";
+        if (use_socket_)
+            sendto(out_fd_, msg.data(), msg.size(), MSG_DONTWAIT, (struct sockaddr *)&addr_, sizeof(addr_));
+        else if (write(out_fd_, msg.data(), msg.size()) < 0)
+            return;
+    }
+
+    std::vector<Rule> rules_;
+    std::vector<State> state_;
+    std::vector<uint32_t> hits_;
+    unsigned long long tick_{0};
+    size_t firing_count_{0};
+    double last_eval_us_{0};
+    int out_fd_{-1};
+    bool use_socket_{false};
+    struct sockaddr_un addr_;
+};
+
+// Per-process baselines: an EWMA mean and variance for each watched metric,
+// kept in one float column per metric indexed by slot. Each tick a present
+// slot is scored by how many standard deviations it sits from its baseline
+// before the sample is folded in. The update is branch-free arithmetic over
+// 4-wide vectors; absent slots are masked out rather than skipped.
+class AnomalyDetector {
+public:
+    enum Watched { CPU, RSS, IO, FAULTS, NUM_WATCHED };
+
+    explicit AnomalyDetector(double window_s = 300.0, float warmup = 10.0f) : window_s_(window_s), warmup_(warmup) {}
+
+    void reset(uint32_t slot) {
+        ensure((size_t)slot + 1);
+        count_[slot] = 0.0f;
+    }
+
+    void update(const SlotMetrics &m, double dt_s) {
+        typedef float vf4 __attribute__((vector_size(16)));
+        typedef int32_t vi4 __attribute__((vector_size(16)));
+        static const int source[NUM_WATCHED] = {SlotMetrics::CPU, SlotMetrics::RSS_KB, SlotMetrics::IO_KBS,
+                                                SlotMetrics::FAULTS};
+        // Variance floors keep a perfectly flat baseline from turning noise into huge scores.
+        static const float floor_sd[NUM_WATCHED] = {1.0f, 1024.0f, 4.0f, 10.0f};
+        ensure(m.size());
+        const float a = (float)(1.0 - std::exp(-dt_s / window_s_));
+        const vf4 va = a - (vf4){}, one = 1.0f - (vf4){}, zero = (vf4){}, warm = warmup_ - (vf4){};
+        std::fill(score2_.begin(), score2_.end(), 0.0f);
+        std::fill(which_.begin(), which_.end(), -1);
+        const size_t n = m.size();
+        for (int w = 0; w < NUM_WATCHED; ++w) {
+            const float *x = m.col[source[w]].data();
+            float *mean = mean_[w].data(), *var = var_[w].data();
+            const vf4 vfloor = floor_sd[w] * floor_sd[w] - (vf4){};
+            for (size_t i = 0; i < n; i += 4) {
+                vf4 p, cnt, xv, mu, v, best;
+                memcpy(&p, &m.present[i], sizeof(p));
+                memcpy(&cnt, &count_[i], sizeof(cnt));
+                memcpy(&xv, x + i, sizeof(xv));
+                memcpy(&mu, mean + i, sizeof(mu));
+                memcpy(&v, var + i, sizeof(v));
+                memcpy(&best, &score2_[i], sizeof(best));
+                vi4 live = p > zero;
+                vi4 fresh = cnt <= zero;
+                xv = live ? xv : mu;  // NaN for absent slots never reaches the baseline
+                mu = fresh ? xv : mu;
+                v = fresh ? zero : v;
+                vf4 d = xv - mu;
+                vf4 z2 = d * d / (v + vfloor);
+                z2 = (live & (cnt >= warm)) ? z2 : zero;
+                vi4 better = z2 > best;
+                best = better ? z2 : best;
+                mu += p * va * d;
+                v += p * ((one - va) * (v + va * d * d) - v);
+                memcpy(mean + i, &mu, sizeof(mu));
+                memcpy(var + i, &v, sizeof(v));
+                memcpy(&score2_[i], &best, sizeof(best));
+                for (int k = 0; k < 4; ++k)
+                    if (better[k]) which_[i + k] = (int8_t)w;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) count_[i] += m.present[i];
+    }
+
+    float score(uint32_t slot) const { return slot < score2_.size() ? std::sqrt(score2_[slot]) : 0.0f; }
+    char metric(uint32_t slot) const {
+        static const char tag[NUM_WATCHED] = {'c', 'm', 'i', 'f'};
+        return slot < which_.size() && which_[slot] >= 0 ? tag[which_[slot]] : ' ';
+    }
+
+private:
+    void ensure(size_t n) {
+        if (n <= count_.size()) return;
+        n = (n + SlotMetrics::BLOCK - 1) / SlotMetrics::BLOCK * SlotMetrics::BLOCK;
+        count_.resize(n, 0.0f);
+        score2_.resize(n, 0.0f);
+        which_.resize(n, -1);
+        for (int w = 0; w < NUM_WATCHED; ++w) {
+            mean_[w].resize(n, 0.0f);
+            var_[w].resize(n, 0.0f);
+        }
+    }
+
+    double window_s_;
+    float warmup_;
+    std::vector<float> count_, score2_;
+    std::vector<int8_t> which_;
+    std::vector<float> mean_[NUM_WATCHED], var_[NUM_WATCHED];
+};
+
+struct LeakReport {
+    uint32_t slot;
+    double rss_kb;
+    double slope_kb_s;
+    double r2;
+    double span_s;
+};
+
+// Exponentially forgetting least-squares fit of RSS against time per slot.
+// Each update decays and adds to six running sums, so it is O(1) per process
+// and recent growth dominates the fit. A process is flagged when the fit
+// covers enough time, explains most of the variance and grows fast enough.
+class LeakDetector {
+public:
+    explicit LeakDetector(double tau_s = 1800.0, double min_span_s = 300.0, double min_r2 = 0.8,
+                          double min_kb_per_hour = 10240.0)
+        : tau_s_(tau_s), min_span_s_(min_span_s), min_r2_(min_r2), min_slope_(min_kb_per_hour / 3600.0) {}
+
+    void reset(uint32_t slot) {
+        ensure((size_t)slot + 1);
+        w_[slot] = 0;
+    }
+
+    void update(const SlotMetrics &m, double now_s, double dt_s) {
+        ensure(m.size());
+        const double decay = std::exp(-dt_s / tau_s_);
+        const float *rss = m.col[SlotMetrics::RSS_KB].data();
+        reports_.clear();
+        for (size_t i = 0; i < m.size(); ++i) {
+            if (!(m.present[i] > 0)) continue;
+            if (w_[i] == 0) {
+                t0_[i] = now_s;
+                st_[i] = sy_[i] = stt_[i] = sty_[i] = syy_[i] = 0;
+            }
+            double t = now_s - t0_[i], y = rss[i];
+            w_[i] = w_[i] * decay + 1.0;
+            st_[i] = st_[i] * decay + t;
+            sy_[i] = sy_[i] * decay + y;
+            stt_[i] = stt_[i] * decay + t * t;
+            sty_[i] = sty_[i] * decay + t * y;
+            syy_[i] = syy_[i] * decay + y * y;
+            if (t < min_span_s_) continue;
+            double vt = w_[i] * stt_[i] - st_[i] * st_[i];
+            double vy = w_[i] * syy_[i] - sy_[i] * sy_[i];
+            double cov = w_[i] * sty_[i] - st_[i] * sy_[i];
+            if (vt <= 0 || vy <= 0 || cov <= 0) continue;
+            double slope = cov / vt;
+            double r2 = cov * cov / (vt * vy);
+            if (slope < min_slope_ || r2 < min_r2_) continue;
+            reports_.push_back(LeakReport{(uint32_t)i, y, slope, r2, t});
+        }
+        std::sort(reports_.begin(), reports_.end(), [](const LeakReport &a, const LeakReport &b) {
+            return a.slope_kb_s > b.slope_kb_s;
+        });
+    }
+
+    const std::vector<LeakReport> &reports() const { return reports_; }
+
+private:
+    void ensure(size_t n) {
+        if (n <= w_.size()) return;
+        for (auto *v : {&w_, &t0_, &st_, &sy_, &stt_, &sty_, &syy_}) v->resize(n, 0.0);
+    }
+
+    double tau_s_, min_span_s_, min_r2_, min_slope_;
+    std::vector<double> w_, t0_, st_, sy_, stt_, sty_, syy_;
+    std::vector<LeakReport> reports_;
+};
+
+// NUMA placement. Per node: memory and the numa_hit/numa_miss counters
+// from /sys/devices/system/node. Per process: where its pages are
+// (numa_maps) and which nodes its threads last ran on (the processor field
+// of task/*/stat, mapped through each node's cpulist). Reading numa_maps
+// makes the kernel walk the page tables, so only the largest processes are
+// candidates and they are visited round robin until the per-tick budget is
+// spent; each result is kept per (pid, starttime) until the next visit.
+// On a single node no memory can be remote, so processes are not sampled.
+class NumaMonitor {
+public:
+    struct Node {
+        int id{0};
+        unsigned long mem_total_kb{0}, mem_free_kb{0};
+        unsigned long long numa_hit{0}, numa_miss{0};
+        double hit_per_s{0}, miss_per_s{0};
+    };
+    struct Placement {
+        std::vector<unsigned long> node_kb;  // by node index
+        uint64_t thread_nodes{0};            // bit per node index some thread last ran on
+        int threads{0};
+        unsigned long remote_kb{0};          // memory on nodes none of the threads ran on
+        unsigned long total_kb{0};
+        unsigned long long tick{0};
+    };
+    struct Report {
+        int pid;
+        std::string cmd;
+        Placement pl;
+    };
+
+    explicit NumaMonitor(double budget_ms = 5.0, size_t max_candidates = 512, int max_threads = 256)
+        : budget_ms_(budget_ms), max_candidates_(max_candidates), max_threads_(max_threads) {}
+
+    bool available() const { return !nodes_.empty(); }
+    const std::vector<Node> &nodes() const { return nodes_; }
+    const std::vector<Report> &reports() const { return reports_; }
+    size_t sampled() const { return sampled_; }
+    double sample_ms() const { return sample_ms_; }
+
+    // Node index of a CPU, -1 when unknown.
+    int cpu_node(int cpu) const { return cpu >= 0 && cpu < (int)cpu_node_.size() ? cpu_node_[cpu] : -1; }
+
+    void update(const ProcMap &procs, double dt_s, unsigned long long tick) {
+        if (!discovered_) discover();
+        if (nodes_.empty()) return;
+        read_nodes(dt_s);
+        if (nodes_.size() < 2) return;
+        sample(procs, tick);
+        for (auto it = cache_.begin(); it != cache_.end();)
+            it = procs.count(it->first) ? std::next(it) : cache_.erase(it);
+        reports_.clear();
+        for (auto &kv : cache_) {
+            const Placement &pl = kv.second;
+            // Mostly remote memory; tiny processes are not worth a line.
+            if (pl.total_kb < 1024 || pl.remote_kb * 2 < pl.total_kb) continue;
+            auto p = procs.find(kv.first);
+            reports_.push_back(Report{kv.first.pid, p->second.cmd, pl});
+        }
+        std::sort(reports_.begin(), reports_.end(),
+                  [](const Report &a, const Report &b) { return a.pl.remote_kb > b.pl.remote_kb; });
+    }
+
+private:
+    static constexpr const char *SYS_NODES = "/sys/devices/system/node";
+
+    void discover() {
+        discovered_ = true;
+        DIR *d = opendir(SYS_NODES);
+        if (!d) return;
+        std::vector<int> ids;
+        while (struct dirent *e = readdir(d)) {
+            int id;
+            char tail;
+            if (sscanf(e->d_name, "node%d%c", &id, &tail) == 1) ids.push_back(id);
+        }
+        closedir(d);
+        std::sort(ids.begin(), ids.end());
+        for (int id : ids) {
+            if (nodes_.size() == 64) break;  // thread_nodes is a 64-bit mask
+            Node n;
+            n.id = id;
+            node_index_[id] = (int)nodes_.size();
+            std::ifstream f(node_path(id, "cpulist"));
+            std::string list;
+            std::getline(f, list);
+            for (int cpu : parse_cpu_list(list)) {
+                if (cpu >= (int)cpu_node_.size()) cpu_node_.resize(cpu + 1, -1);
+                cpu_node_[cpu] = (int)nodes_.size();
+            }
+            nodes_.push_back(n);
+        }
+    }
+
+    static std::string node_path(int id, const char *file) {
+        return std::string(SYS_NODES) + "/node" + std::to_string(id) + "/" + file;
+    }
+
+    void read_nodes(double dt_s) {
+        for (Node &n : nodes_) {
+            std::ifstream mi(node_path(n.id, "meminfo"));
+            std::string line;
+            while (std::getline(mi, line)) {
+                // "Node 0 MemTotal:       16333980 kB"
+                char key[64];
+                unsigned long v;
+                if (sscanf(line.c_str(), "Node %*d %63s %lu", key, &v) != 2) continue;
+                if (!strcmp(key, "MemTotal:")) n.mem_total_kb = v;
+                else if (!strcmp(key, "MemFree:")) n.mem_free_kb = v;
+            }
+            std::ifstream ns(node_path(n.id, "numastat"));
+            std::string key;
+            unsigned long long v, hit = n.numa_hit, miss = n.numa_miss;
+            while (ns >> key >> v) {
+                if (key == "numa_hit") hit = v;
+                else if (key == "numa_miss") miss = v;
+            }
+            if (dt_s > 0 && n.numa_hit) {
+                n.hit_per_s = hit >= n.numa_hit ? (hit - n.numa_hit) / dt_s : 0;
+                n.miss_per_s = miss >= n.numa_miss ? (miss - n.numa_miss) / dt_s : 0;
+            } else {
+                n.hit_per_s = n.miss_per_s = 0;
+            }
+            n.numa_hit = hit;
+            n.numa_miss = miss;
+        }
+    }
+
+    void sample(const ProcMap &procs, unsigned long long tick) {
+        std::vector<const ProcInfo *> cand;
+        for (auto &kv : procs)
+            if (kv.second.rss > 0) cand.push_back(&kv.second);
+        size_t n = std::min(cand.size(), max_candidates_);
+        std::partial_sort(cand.begin(), cand.begin() + n, cand.end(),
+                          [](const ProcInfo *a, const ProcInfo *b) { return a->rss > b->rss; });
+        cand.resize(n);
+        auto start = std::chrono::steady_clock::now();
+        sampled_ = 0;
+        for (; sampled_ < n; ++sampled_) {
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >
+                budget_ms_)
+                break;
+            const ProcInfo &p = *cand[rotate_++ % n];
+            Placement pl;
+            pl.tick = tick;
+            if (!read_numa_maps(p.pid, pl)) continue;
+            read_threads(p, pl);
+            for (size_t i = 0; i < pl.node_kb.size(); ++i)
+                if (!(pl.thread_nodes >> i & 1)) pl.remote_kb += pl.node_kb[i];
+            cache_[p.key()] = pl;
+        }
+        sample_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Sums the N<node>=<pages> fields of every mapping.
+    bool read_numa_maps(int pid, Placement &pl) {
+        FILE *f = fopen((g_proc_root + "/" + std::to_string(pid) + "/numa_maps").c_str(), "re");
+        if (!f) return false;
+        pl.node_kb.assign(nodes_.size(), 0);
+        char *line = nullptr;
+        size_t cap = 0;
+        while (getline(&line, &cap, f) > 0) {
+            unsigned long page_kb = 4;
+            if (const char *ps = strstr(line, "kernelpagesize_kB=")) page_kb = strtoul(ps + 18, nullptr, 10);
+            for (const char *q = strstr(line, " N"); q; q = strstr(q + 2, " N")) {
+                char *end;
+                long id = strtol(q + 2, &end, 10);
+                if (end == q + 2 || *end != '=') continue;
+                auto it = node_index_.find((int)id);
+                if (it == node_index_.end()) continue;
+                unsigned long kb = strtoul(end + 1, nullptr, 10) * page_kb;
+                pl.node_kb[it->second] += kb;
+                pl.total_kb += kb;
+            }
+        }
+        free(line);
+        fclose(f);
+        return true;
+    }
+
+    void read_threads(const ProcInfo &p, Placement &pl) {
+        std::string dir = g_proc_root + "/" + std::to_string(p.pid) + "/task";
+        if (DIR *d = opendir(dir.c_str())) {
+            char buf[1024];
+            while (struct dirent *e = readdir(d)) {
+                if (e->d_name[0] == '.' || pl.threads >= max_threads_) continue;
+                int fd = ::open((dir + "/" + e->d_name + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) continue;
+                ssize_t len = ::read(fd, buf, sizeof(buf) - 1);
+                ::close(fd);
+                if (len <= 0) continue;
+                buf[len] = 0;
+                // processor is the 37th field after the command
+                const char *q = strrchr(buf, ')');
+                for (int i = 0; i < 37 && q; ++i) {
+                    q = strchr(q + 1, ' ');
+                }
+                if (!q) continue;
+                int node = cpu_node(atoi(q + 1));
+                if (node >= 0) pl.thread_nodes |= 1ULL << node;
+                pl.threads++;
+            }
+            closedir(d);
+        }
+        if (!pl.threads && cpu_node(p.processor) >= 0) {
+            pl.thread_nodes = 1ULL << cpu_node(p.processor);
+            pl.threads = 1;
+        }
+    }
+
+    double budget_ms_;
+    size_t max_candidates_;
+    int max_threads_;
+    bool discovered_{false};
+    std::vector<Node> nodes_;
+    std::unordered_map<int, int> node_index_;
+    std::vector<int> cpu_node_;
+    std::unordered_map<ProcKey, Placement, ProcKeyHash> cache_;
+    std::vector<Report> reports_;
+    size_t rotate_{0}, sampled_{0};
+    double sample_ms_{0};
+};
+
+// Where the busiest processes run. Every tick the top processes by CPU get
+// their last-run CPU (stat field 39) added to a decaying per-core heat row,
+// their migration count read from /proc/<pid>/sched (se.nr_migrations; a
+// change of last-run CPU counts as one when that file is missing) and their
+// Cpus_allowed_list from status. Only that small set touches the extra
+// files. Per core, the CPU% of the hot processes last seen there is summed
+// so pinned services piling onto one core stand out.
+class CpuPlacement {
+public:
+    struct Row {
+        ProcKey key;
+        std::string cmd;
+        double cpu_percent{0};
+        int last_cpu{-1};
+        double migrations_per_s{0};
+        std::vector<float> heat;         // by CPU id
+        std::vector<unsigned char> allowed;
+        int allowed_count{0};
+    };
+
+    explicit CpuPlacement(size_t hot = 32, double decay = 0.7) : hot_(hot), decay_(decay) {}
+
+    void update(const ProcMap &procs, double dt_s) {
+        ncpus_ = std::max(1, (int)sysconf(_SC_NPROCESSORS_CONF));
+        online_ = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+        std::vector<const ProcInfo *> top;
+        for (auto &kv : procs)
+            if (kv.second.cpu_percent > 0) top.push_back(&kv.second);
+        size_t n = std::min(top.size(), hot_);
+        std::partial_sort(top.begin(), top.begin() + n, top.end(),
+                          [](const ProcInfo *a, const ProcInfo *b) { return a->cpu_percent > b->cpu_percent; });
+        top.resize(n);
+
+        core_load_.assign(ncpus_, 0.0);
+        std::unordered_map<ProcKey, State, ProcKeyHash> next;
+        rows_.clear();
+        for (const ProcInfo *p : top) {
+            auto it = state_.find(p->key());
+            State st = it != state_.end() ? it->second : State();
+            st.heat.resize(ncpus_, 0.0f);
+            for (float &h : st.heat) h *= (float)decay_;
+            int cpu = p->processor;
+            if (cpu >= 0 && cpu < ncpus_) {
+                st.heat[cpu] += (float)p->cpu_percent;
+                core_load_[cpu] += p->cpu_percent;
+            }
+            long long migr = read_migrations(p->pid);
+            double moved = 0;
+            if (migr >= 0) moved = st.migrations >= 0 && migr >= st.migrations ? (double)(migr - st.migrations) : 0;
+            else moved = st.last_cpu >= 0 && cpu != st.last_cpu;
+            st.migrations = migr;
+            st.last_cpu = cpu;
+
+            Row r;
+            r.key = p->key();
+            r.cmd = p->cmd;
+            r.cpu_percent = p->cpu_percent;
+            r.last_cpu = cpu;
+            r.migrations_per_s = it != state_.end() && dt_s > 0 ? moved / dt_s : 0;
+            r.heat = st.heat;
+            r.allowed.assign(ncpus_, 0);
+            for (int c : read_allowed(p->pid))
+                if (c >= 0 && c < ncpus_ && !r.allowed[c]) {
+                    r.allowed[c] = 1;
+                    r.allowed_count++;
+                }
+            if (!r.allowed_count) {  // status unreadable: don't claim it is pinned
+                std::fill(r.allowed.begin(), r.allowed.end(), 1);
+                r.allowed_count = ncpus_;
+            }
+            rows_.push_back(std::move(r));
+            next[p->key()] = std::move(st);
+        }
+        state_.swap(next);
+    }
+
+    const std::vector<Row> &rows() const { return rows_; }
+    const std::vector<double> &core_load() const { return core_load_; }
+    int ncpus() const { return ncpus_; }
+    bool restricted(const Row &r) const { return r.allowed_count < online_; }
+
+private:
+    struct State {
+        std::vector<float> heat;
+        int last_cpu{-1};
+        long long migrations{-1};
+    };
+
+    static long long read_migrations(int pid) {
+        std::ifstream f(g_proc_root + "/" + std::to_string(pid) + "/sched");
+        std::string line;
+        while (std::getline(f, line))
+            if (line.compare(0, 16, "se.nr_migrations") == 0) {
+                size_t colon = line.find(':');
+                return colon == std::string::npos ? -1 : atoll(line.c_str() + colon + 1);
+            }
+        return -1;
+    }
+
+    static std::vector<int> read_allowed(int pid) {
+        std::ifstream f(g_proc_root + "/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(f, line))
+            if (line.compare(0, 18, "Cpus_allowed_list:") == 0) {
+                size_t b = line.find_first_not_of(" \t", 18);
+                return b == std::string::npos ? std::vector<int>() : parse_cpu_list(line.substr(b));
+            }
+        return std::vector<int>();
+    }
+
+    size_t hot_;
+    double decay_;
+    int ncpus_{1}, online_{1};
+    std::unordered_map<ProcKey, State, ProcKeyHash> state_;
+    std::vector<Row> rows_;
+    std::vector<double> core_load_;
+};
+
+// perf_event_open counters for the top N processes by CPU. Each thread
+// (up to max_threads per process) gets one group so its hardware counters
+// cover the same interval: cycles leading instructions and cache-misses,
+// user space only, which gives IPC and misses per thousand instructions
+// and needs perf_event_paranoid <= 2 for one's own processes. Context
+// switches happen in the kernel, so they are a separate event with kernel
+// counting on; that needs paranoid <= 1 or root. A thread without a
+// hardware group (no PMU in VMs and containers, or paranoid 3) gets a
+// software group instead: task-clock, user space only, for its time on
+// CPU, led with a user-space context switch count while the kernel one is
+// off. Kernels that filter switches by mode report 0 there, so that count
+// only turns the CSW column on once it has seen a switch. error() says
+// what is missing and why.
+// Groups stay open while a process stays near the top: a process that
+// drops out keeps its groups for `linger` ticks in case it comes back, and
+// only newcomers open new ones.
+class PerfCounters {
+public:
+    explicit PerfCounters(size_t top_n, int max_threads = 16, unsigned linger = 3)
+        : top_n_(top_n), max_threads_(max_threads), linger_(linger) {
+        if (!top_n_ || geteuid() == 0) return;
+        std::ifstream f("/proc/sys/kernel/perf_event_paranoid");
+        int paranoid = 2;
+        f >> paranoid;
+        std::string why = "perf_event_paranoid is " + std::to_string(paranoid);
+        if (paranoid > 1) settle(csw_, csw_error_, "context switches: " + why);
+        if (paranoid > 2) settle(hw_, hw_error_, "hardware counters: " + why);
+    }
+    ~PerfCounters() {
+        for (auto &kv : tracks_)
+            for (Group &g : kv.second.groups) close_group(g);
+    }
+
+    bool hardware() const { return hw_ == COUNTING; }
+    bool switches() const { return csw_ == COUNTING || user_csw_seen_; }
+    bool task_clock() const { return clk_ == COUNTING; }
+    // Why hardware counters, the task clock or context switches are not
+    // counted; empty while they are (or have not been tried yet).
+    std::string error() const {
+        std::string e = hw_ == COUNTING ? "" : hw_error_;
+        if (!hardware() && !task_clock() && !clk_error_.empty()) e += (e.empty() ? "" : "; ") + clk_error_;
+        if (!switches() && !csw_error_.empty()) e += (e.empty() ? "" : "; ") + csw_error_;
+        return e;
+    }
+    size_t groups() const {
+        size_t n = 0;
+        for (auto &kv : tracks_) n += kv.second.groups.size();
+        return n;
+    }
+
+    // Opens, reads and retires groups for this tick and stores the results
+    // on the counted processes.
+    void update(ProcMap &procs, double dt_s, unsigned long long tick) {
+        if (!top_n_ || (hw_ == OFF && csw_ == OFF && clk_ == OFF)) return;
+        std::vector<ProcInfo *> top;
+        for (auto &kv : procs)
+            if (kv.second.cpu_percent > 0) top.push_back(&kv.second);
+        size_t n = std::min(top.size(), top_n_);
+        std::partial_sort(top.begin(), top.begin() + n, top.end(),
+                          [](const ProcInfo *a, const ProcInfo *b) { return a->cpu_percent > b->cpu_percent; });
+        for (size_t i = 0; i < n; ++i) tracks_[top[i]->key()].last_top = tick;
+
+        for (auto it = tracks_.begin(); it != tracks_.end();) {
+            auto p = procs.find(it->first);
+            if (p == procs.end() || tick - it->second.last_top > linger_) {
+                for (Group &g : it->second.groups) close_group(g);
+                it = tracks_.erase(it);
+                continue;
+            }
+            sync_threads(p->second.pid, it->second);
+            read_track(it->second, p->second, dt_s);
+            ++it;
+        }
+    }
+
+private:
+    enum State { UNTRIED, COUNTING, OFF };
+    static const int HW_EVENTS = 3;
+    static const int SW_EVENTS = 2;
+    struct Group {
+        int tid{0};
+        int fds[HW_EVENTS];
+        int n{0};
+        int csw_fd{-1};
+        int sw_fds[SW_EVENTS];  // task-clock, then user-space context switches
+        int sw_n{0};
+        bool primed{false}, csw_primed{false}, sw_primed{false};
+        uint64_t last[HW_EVENTS]{}, enabled{0}, running{0}, last_csw{0}, sw_last[SW_EVENTS]{};
+    };
+    struct Track {
+        std::vector<Group> groups;
+        unsigned long long last_top{0};
+    };
+
+    static int open_event(uint32_t type, uint64_t config, int tid, int group_fd, bool user_only) {
+        struct perf_event_attr a;
+        memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = type;
+        a.config = config;
+        if (user_only)
+            a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        a.exclude_kernel = user_only;
+        a.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &a, tid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    static void settle(State &s, std::string &error, const std::string &why) {
+        s = OFF;
+        error = why;
+    }
+
+    // Opens the hardware group and the context switch event for a thread.
+    // A refusal for this thread only (another user's, EACCES/EPERM) skips
+    // it; any other error means the event is not available at all.
+    bool open_group(int tid, Group &g) {
+        static const uint64_t hw[HW_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_CACHE_MISSES};
+        g = Group();
+        g.tid = tid;
+        if (hw_ != OFF) {
+            for (uint64_t e : hw) {
+                int fd = open_event(PERF_TYPE_HARDWARE, e, tid, g.n ? g.fds[0] : -1, true);
+                if (fd < 0) break;
+                g.fds[g.n++] = fd;
+            }
+            if (g.n == HW_EVENTS) {
+                hw_ = COUNTING;
+            } else {
+                int err = errno;
+                close_group(g);
+                if (err == ESRCH) return false;
+                std::string why = std::string("hardware counters: ") + strerror(err);
+                if (err == EACCES || err == EPERM) hw_error_ = why;
+                else settle(hw_, hw_error_, why);
+            }
+        }
+        if (csw_ != OFF) {
+            g.csw_fd = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, tid, -1, false);
+            if (g.csw_fd >= 0) {
+                csw_ = COUNTING;
+            } else {
+                int err = errno;
+                if (err == ESRCH) {
+                    close_group(g);
+                    return false;
+                }
+                std::string why = std::string("context switches: ") + strerror(err);
+                if (err == EACCES || err == EPERM) csw_error_ = why;
+                else settle(csw_, csw_error_, why);
+            }
+        }
+        if (!g.n && clk_ != OFF) {
+            g.sw_fds[g.sw_n++] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, tid, -1, true);
+            if (g.sw_fds[0] < 0) {
+                int err = errno;
+                g.sw_n = 0;
+                if (err == ESRCH) {
+                    close_group(g);
+                    return false;
+                }
+                std::string why = std::string("task clock: ") + strerror(err);
+                if (err == EACCES || err == EPERM) clk_error_ = why;
+                else settle(clk_, clk_error_, why);
+            } else {
+                clk_ = COUNTING;
+                int fd = -1;
+                if (csw_ == OFF)
+                    fd = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, tid, g.sw_fds[0], true);
+                if (fd >= 0) g.sw_fds[g.sw_n++] = fd;
+            }
+        }
+        return g.n || g.csw_fd >= 0 || g.sw_n;
+    }
+
+    static void close_group(Group &g) {
+        for (int i = 0; i < g.n; ++i) close(g.fds[i]);
+        g.n = 0;
+        for (int i = 0; i < g.sw_n; ++i) close(g.sw_fds[i]);
+        g.sw_n = 0;
+        if (g.csw_fd >= 0) close(g.csw_fd);
+        g.csw_fd = -1;
+    }
+
+    // Matches the groups to the process's current threads.
+    void sync_threads(int pid, Track &t) {
+        std::vector<int> tids;
+        if (DIR *d = opendir((g_proc_root + "/" + std::to_string(pid) + "/task").c_str())) {
+            while (struct dirent *e = readdir(d))
+                if (e->d_name[0] != '.') tids.push_back(atoi(e->d_name));
+            closedir(d);
+        }
+        std::sort(tids.begin(), tids.end());
+        for (auto g = t.groups.begin(); g != t.groups.end();) {
+            if (std::binary_search(tids.begin(), tids.end(), g->tid)) {
+                ++g;
+            } else {
+                close_group(*g);
+                g = t.groups.erase(g);
+            }
+        }
+        for (int tid : tids) {
+            if ((int)t.groups.size() >= max_threads_) break;
+            bool have = false;
+            for (const Group &g : t.groups) have |= g.tid == tid;
+            if (have) continue;
+            Group g;
+            if (open_group(tid, g)) t.groups.push_back(g);
+            if (hw_ == OFF && csw_ == OFF && clk_ == OFF) return;
+        }
+    }
+
+    // Sums the threads' deltas, hardware counts scaled up for time the PMU
+    // multiplexed away.
+    void read_track(Track &t, ProcInfo &p, double dt_s) {
+        double sum[HW_EVENTS] = {0, 0, 0}, csw = 0, clock_ns = 0, user_csw = 0;
+        bool any_hw = false, any_csw = false, any_sw = false, any_user_csw = false;
+        for (Group &g : t.groups) {
+            uint64_t buf[3 + HW_EVENTS];
+            ssize_t len = g.n ? ::read(g.fds[0], buf, sizeof(buf)) : -1;
+            if (len >= (ssize_t)(sizeof(uint64_t) * (3 + g.n)) && buf[0] == (uint64_t)g.n) {
+                if (g.primed && buf[2] > g.running) {
+                    double scale = (double)(buf[1] - g.enabled) / (double)(buf[2] - g.running);
+                    for (int i = 0; i < g.n; ++i) sum[i] += (double)(buf[3 + i] - g.last[i]) * scale;
+                    any_hw = true;
+                }
+                g.primed = true;
+                g.enabled = buf[1];
+                g.running = buf[2];
+                for (int i = 0; i < g.n; ++i) g.last[i] = buf[3 + i];
+            }
+            uint64_t v;
+            if (g.csw_fd >= 0 && ::read(g.csw_fd, &v, sizeof(v)) == (ssize_t)sizeof(v)) {
+                if (g.csw_primed) {
+                    csw += (double)(v - g.last_csw);
+                    any_csw = true;
+                }
+                g.csw_primed = true;
+                g.last_csw = v;
+            }
+            uint64_t sw[3 + SW_EVENTS];
+            len = g.sw_n ? ::read(g.sw_fds[0], sw, sizeof(sw)) : -1;
+            if (len >= (ssize_t)(sizeof(uint64_t) * (3 + g.sw_n)) && sw[0] == (uint64_t)g.sw_n) {
+                if (g.sw_primed) {
+                    clock_ns += (double)(sw[3] - g.sw_last[0]);
+                    if (g.sw_n > 1) {
+                        user_csw += (double)(sw[4] - g.sw_last[1]);
+                        any_user_csw = true;
+                    }
+                    any_sw = true;
+                }
+                g.sw_primed = true;
+                for (int i = 0; i < g.sw_n; ++i) g.sw_last[i] = sw[3 + i];
+            }
+        }
+        if (dt_s <= 0) return;
+        if (any_hw) {
+            if (sum[0] > 0) p.ipc = (float)(sum[1] / sum[0]);
+            if (sum[1] > 0) p.mpki = (float)(sum[2] / (sum[1] / 1000.0));
+        }
+        if (any_csw) p.csw_per_s = (float)(csw / dt_s);
+        if (any_sw) p.oncpu_percent = (float)(clock_ns / (dt_s * 1e9) * 100.0);
+        user_csw_seen_ |= user_csw > 0;
+        if (any_user_csw && user_csw_seen_ && !any_csw) p.csw_per_s = (float)(user_csw / dt_s);
+    }
+
+    size_t top_n_;
+    int max_threads_;
+    unsigned linger_;
+    State hw_{UNTRIED}, csw_{UNTRIED}, clk_{UNTRIED};
+    std::string hw_error_, csw_error_, clk_error_;
+    bool user_csw_seen_{false};
+    std::unordered_map<ProcKey, Track, ProcKeyHash> tracks_;
+};
+
+// CFS bandwidth per cgroup: its quota, how much of it was used and how
+// often it was throttled over the last interval. A container can sit at
+// its quota while each of its processes shows a modest CPU%, and only the
+// cgroup's cpu.stat tells. cgroup v2 reads cpu.max and cpu.stat; v1 reads
+// cpu.cfs_quota_us, cpu.cfs_period_us, cpu.stat and cpuacct.usage. The
+// tree is walked every `rescan_ticks` ticks; in between the files stay
+// open and are re-read with pread, so a tick costs a few reads per cgroup.
+class CgroupThrottle {
+public:
+    struct Row {
+        std::string path;                // relative to the hierarchy root
+        double quota_cpus{-1};           // quota / period; -1 without a quota
+        double used_cpus{0};             // CPU seconds per second
+        double util_percent{-1};         // of the quota; -1 without a quota
+        unsigned long long throttled{0}; // periods throttled in the interval
+        double throttled_percent{0};     // of the periods that elapsed
+        double throttled_ms{0};          // time held back in the interval
+    };
+
+    explicit CgroupThrottle(unsigned rescan_ticks = 10, size_t max_groups = 1024)
+        : rescan_ticks_(rescan_ticks), max_groups_(max_groups) {}
+    ~CgroupThrottle() {
+        for (auto &kv : groups_) close_group(kv.second);
+    }
+
+    bool available() const { return !cpu_root_.empty(); }
+    int version() const { return v2_ ? 2 : 1; }
+    const std::string &root() const { return cpu_root_; }
+    size_t groups() const { return groups_.size(); }
+    size_t with_quota() const { return with_quota_; }
+    const std::vector<Row> &rows() const { return rows_; }
+
+    void update(double dt_s, unsigned long long tick) {
+        if (!located_) locate();
+        if (cpu_root_.empty()) return;
+        if (tick >= next_scan_) {
+            rescan();
+            next_scan_ = tick + rescan_ticks_;
+        }
+        rows_.clear();
+        with_quota_ = 0;
+        for (auto it = groups_.begin(); it != groups_.end();) {
+            Group &g = it->second;
+            Sample s;
+            if (!sample(g, s)) {  // removed since the last walk
+                close_group(g);
+                it = groups_.erase(it);
+                continue;
+            }
+            if (s.quota_us > 0) ++with_quota_;
+            if (g.primed && dt_s > 0) rows_.push_back(delta(it->first, g.last, s, dt_s));
+            g.last = s;
+            g.primed = true;
+            ++it;
+        }
+        // Most time held back first, then closest to the quota.
+        std::sort(rows_.begin(), rows_.end(), [](const Row &a, const Row &b) {
+            if (a.throttled_ms != b.throttled_ms) return a.throttled_ms > b.throttled_ms;
+            if (a.throttled != b.throttled) return a.throttled > b.throttled;
+            if (a.util_percent != b.util_percent) return a.util_percent > b.util_percent;
+            return a.used_cpus > b.used_cpus;
+        });
+    }
+
+private:
+    struct Sample {
+        long long quota_us{-1}, period_us{0};
+        unsigned long long usage_ns{0}, periods{0}, throttled{0}, throttled_ns{0};
+    };
+    struct Group {
+        int stat_fd{-1}, max_fd{-1}, period_fd{-1}, usage_fd{-1};  // period_fd and usage_fd are v1 only
+        bool primed{false}, seen{false};
+        Sample last;
+    };
+
+    static void close_fd(int &fd) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+    static void close_group(Group &g) {
+        close_fd(g.stat_fd);
+        close_fd(g.max_fd);
+        close_fd(g.period_fd);
+        close_fd(g.usage_fd);
+    }
+    static int open_ro(const std::string &path) { return ::open(path.c_str(), O_RDONLY | O_CLOEXEC); }
+    static ssize_t reread(int fd, char *buf, size_t cap) {
+        if (fd < 0) return -1;
+        ssize_t n = pread(fd, buf, cap - 1, 0);
+        if (n >= 0) buf[n] = 0;
+        return n;
+    }
+    static bool has_word(const std::string &list, const char *word, char sep) {
+        std::stringstream ss(list);
+        std::string w;
+        while (std::getline(ss, w, sep))
+            if (w == word) return true;
+        return false;
+    }
+
+    // Finds the hierarchy with the cpu controller: cgroup v2 when it has
+    // cpu enabled, otherwise the v1 "cpu" mount (and "cpuacct" for usage,
+    // which may be the same mount).
+    void locate() {
+        located_ = true;
+        std::ifstream f("/proc/self/mountinfo");
+        std::string line, v1_cpu, v1_acct;
+        while (std::getline(f, line)) {
+            std::istringstream ss(line);
+            std::vector<std::string> toks;
+            std::string t;
+            while (ss >> t) toks.push_back(t);
+            auto dash = std::find(toks.begin(), toks.end(), "-");
+            if (toks.size() < 5 || toks.end() - dash < 4) continue;
+            const std::string &mnt = toks[4], &fstype = dash[1], &opts = dash[3];
+            if (fstype == "cgroup2") {
+                std::ifstream c(mnt + "/cgroup.controllers");
+                std::string ctl;
+                std::getline(c, ctl);
+                if (has_word(ctl, "cpu", ' ')) {
+                    cpu_root_ = mnt;
+                    v2_ = true;
+                    return;
+                }
+            } else if (fstype == "cgroup") {
+                if (has_word(opts, "cpu", ',')) v1_cpu = mnt;
+                if (has_word(opts, "cpuacct", ',')) v1_acct = mnt;
+            }
+        }
+        cpu_root_ = v1_cpu;
+        acct_root_ = v1_acct;
+    }
+
+    // Opens the newly created cgroups and drops the removed ones. The root
+    // is skipped: it has no quota and its usage is the whole machine's.
+    void rescan() {
+        for (auto &kv : groups_) kv.second.seen = false;
+        std::vector<std::string> stack{""};
+        size_t found = 0;
+        while (!stack.empty() && found < max_groups_) {
+            std::string rel = stack.back();
+            stack.pop_back();
+            DIR *d = opendir((cpu_root_ + rel).c_str());
+            if (!d) continue;
+            while (struct dirent *e = readdir(d)) {
+                if (e->d_type != DT_DIR || e->d_name[0] == '.') continue;
+                if (found == max_groups_) break;
+                ++found;
+                std::string child = rel + "/" + e->d_name;
+                stack.push_back(child);
+                auto it = groups_.find(child);
+                if (it == groups_.end()) {
+                    Group g;
+                    if (!open_group(child, g)) continue;
+                    it = groups_.emplace(child, g).first;
+                }
+                it->second.seen = true;
+            }
+            closedir(d);
+        }
+        for (auto it = groups_.begin(); it != groups_.end();) {
+            if (it->second.seen) {
+                ++it;
+                continue;
+            }
+            close_group(it->second);
+            it = groups_.erase(it);
+        }
+    }
+
+    bool open_group(const std::string &rel, Group &g) {
+        std::string dir = cpu_root_ + rel + "/";
+        g.stat_fd = open_ro(dir + "cpu.stat");
+        if (g.stat_fd < 0) return false;  // cpu not enabled for this v2 subtree
+        if (v2_) {
+            g.max_fd = open_ro(dir + "cpu.max");
+        } else {
+            g.max_fd = open_ro(dir + "cpu.cfs_quota_us");
+            g.period_fd = open_ro(dir + "cpu.cfs_period_us");
+            if (!acct_root_.empty()) g.usage_fd = open_ro(acct_root_ + rel + "/cpuacct.usage");
+        }
+        return true;
+    }
+
+    bool sample(const Group &g, Sample &s) const {
+        char buf[512];
+        if (reread(g.stat_fd, buf, sizeof(buf)) <= 0) return false;
+        for (char *line = buf; line && *line;) {
+            char *next = strchr(line, '\n');
+            if (next) *next++ = 0;
+            char *val = strchr(line, ' ');
+            if (val) {
+                *val++ = 0;
+                unsigned long long v = strtoull(val, nullptr, 10);
+                if (!strcmp(line, "nr_periods")) s.periods = v;
+                else if (!strcmp(line, "nr_throttled")) s.throttled = v;
+                else if (!strcmp(line, "throttled_usec")) s.throttled_ns = v * 1000;  // v2
+                else if (!strcmp(line, "throttled_time")) s.throttled_ns = v;         // v1
+                else if (!strcmp(line, "usage_usec")) s.usage_ns = v * 1000;          // v2
+            }
+            line = next;
+        }
+        if (v2_) {
+            // "max 100000" or "<quota> <period>"
+            if (reread(g.max_fd, buf, sizeof(buf)) > 0) {
+                char *sp = strchr(buf, ' ');
+                if (sp) {
+                    s.period_us = atoll(sp + 1);
+                    if (strncmp(buf, "max", 3) != 0) s.quota_us = atoll(buf);
+                }
+            }
+        } else {
+            if (reread(g.max_fd, buf, sizeof(buf)) > 0) s.quota_us = atoll(buf);  // -1 without a quota
+            if (reread(g.period_fd, buf, sizeof(buf)) > 0) s.period_us = atoll(buf);
+            if (reread(g.usage_fd, buf, sizeof(buf)) > 0) s.usage_ns = strtoull(buf, nullptr, 10);
+        }
+        return true;
+    }
+
+    static Row delta(const std::string &path, const Sample &a, const Sample &b, double dt_s) {
+        Row r;
+        r.path = path;
+        // A counter that went backwards means the cgroup was recreated in between.
+        auto d = [](unsigned long long x, unsigned long long y) { return y >= x ? y - x : 0ULL; };
+        r.used_cpus = d(a.usage_ns, b.usage_ns) / 1e9 / dt_s;
+        if (b.quota_us > 0 && b.period_us > 0) {
+            r.quota_cpus = (double)b.quota_us / b.period_us;
+            r.util_percent = r.used_cpus / r.quota_cpus * 100.0;
+        }
+        r.throttled = d(a.throttled, b.throttled);
+        unsigned long long periods = d(a.periods, b.periods);
+        r.throttled_percent = periods ? r.throttled * 100.0 / periods : 0;
+        r.throttled_ms = d(a.throttled_ns, b.throttled_ns) / 1e6;
+        return r;
+    }
+
+    unsigned rescan_ticks_;
+    size_t max_groups_;
+    bool located_{false}, v2_{false};
+    std::string cpu_root_, acct_root_;
+    unsigned long long next_scan_{0};
+    size_t with_quota_{0};
+    std::unordered_map<std::string, Group> groups_;
+    std::vector<Row> rows_;
+};
+
+static std::string format_duration(double s) {
+    char buf[32];
+    if (s < 0 || !std::isfinite(s)) return "never";
+    if (s < 3600) snprintf(buf, sizeof(buf), "%.0fm", s / 60);
+    else if (s < 86400 * 2) snprintf(buf, sizeof(buf), "%.1fh", s / 3600);
+    else snprintf(buf, sizeof(buf), "%.1fd", s / 86400);
+    return buf;
+}
+
+enum SortKey { SORT_CPU, SORT_MEM, SORT_AVG1, SORT_AVG10, SORT_AVG60, SORT_ANOMALY, NUM_SORT_KEYS };
+static const char *sort_key_names[NUM_SORT_KEYS] = {"CPU", "MEM", "AVG1s", "AVG10s", "AVG60s", "ANOM"};
+
+void sort_processes(std::vector<ProcInfo> &plist, SortKey key) {
+    auto by = [&](auto field) {
+        std::sort(plist.begin(), plist.end(), [&](const ProcInfo &a, const ProcInfo &b){
+            return field(a) > field(b);
+        });
+    };
+    switch (key) {
+    case SORT_CPU: by([](const ProcInfo &p){ return p.cpu_percent; }); break;
+    case SORT_MEM: by([](const ProcInfo &p){ return p.mem_percent; }); break;
+    case SORT_AVG1: by([](const ProcInfo &p){ return p.cpu_avg[0]; }); break;
+    case SORT_AVG10: by([](const ProcInfo &p){ return p.cpu_avg[1]; }); break;
+    case SORT_AVG60: by([](const ProcInfo &p){ return p.cpu_avg[2]; }); break;
+    case SORT_ANOMALY: by([](const ProcInfo &p){ return p.anomaly; }); break;
+    default: break;
+    }
+}
+
+// One screen of text cells. Drawing code writes into a Frame through
+// Canvases; a Renderer then puts the finished frame on the terminal.
+struct Cell {
+    char ch;
+    uint8_t attr;  // ATTR_* bits
+    bool operator==(const Cell &o) const { return ch == o.ch && attr == o.attr; }
+    bool operator!=(const Cell &o) const { return !(*this == o); }
+};
+
+enum { ATTR_NORMAL = 0, ATTR_REVERSE = 1 };
+
+struct Frame {
+    int rows{0}, cols{0};
+    std::vector<Cell> cells;
+
+    void resize(int r, int c) {
+        rows = std::max(1, r);
+        cols = std::max(1, c);
+        cells.assign((size_t)rows * cols, Cell{' ', ATTR_NORMAL});
+    }
+    void clear() { std::fill(cells.begin(), cells.end(), Cell{' ', ATTR_NORMAL}); }
+    Cell *row(int y) { return &cells[(size_t)y * cols]; }
+    const Cell *row(int y) const { return &cells[(size_t)y * cols]; }
+};
+
+struct Rect {
+    int y{0}, x{0}, h{0}, w{0};
+};
+
+// A clipped rectangle of a Frame with the handful of window operations the
+// draw functions need (the equivalents of werase, box, mvwprintw, wprintw,
+// mvwaddch and A_REVERSE). Output outside the rectangle is dropped.
+class Canvas {
+public:
+    Canvas(Frame &f, Rect r) : f_(&f), r_(r) {
+        // Stacked panes can start above the frame on a short terminal; that
+        // part is cut off like the rest.
+        if (r_.y < 0) {
+            r_.h += r_.y;
+            r_.y = 0;
+        }
+        if (r_.x < 0) {
+            r_.w += r_.x;
+            r_.x = 0;
+        }
+        r_.h = std::max(0, std::min(r_.h, f.rows - r_.y));
+        r_.w = std::max(0, std::min(r_.w, f.cols - r_.x));
+    }
+
+    int rows() const { return r_.h; }
+    int cols() const { return r_.w; }
+    void reverse(bool on) { attr_ = on ? ATTR_REVERSE : ATTR_NORMAL; }
+
+    void erase() {
+        for (int y = 0; y < r_.h; ++y) std::fill(f_->row(r_.y + y) + r_.x, f_->row(r_.y + y) + r_.x + r_.w, Cell{' ', ATTR_NORMAL});
+        cy_ = cx_ = 0;
+    }
+
+    void box() {
+        if (r_.h < 2 || r_.w < 2) return;
+        for (int x = 1; x < r_.w - 1; ++x) {
+            put(0, x, '-');
+            put(r_.h - 1, x, '-');
+        }
+        for (int y = 1; y < r_.h - 1; ++y) {
+            put(y, 0, '|');
+            put(y, r_.w - 1, '|');
+        }
+        put(0, 0, '+'); put(0, r_.w - 1, '+'); put(r_.h - 1, 0, '+'); put(r_.h - 1, r_.w - 1, '+');
+    }
+
+    void put(int y, int x, char ch) {
+        if (y < 0 || y >= r_.h || x < 0 || x >= r_.w) return;
+        unsigned char c = (unsigned char)ch;
+        f_->row(r_.y + y)[r_.x + x] = Cell{c < 32 || c == 127 ? '?' : ch, attr_};
+    }
+
+    void text(int y, int x, const char *s, size_t n) {
+        cy_ = y;
+        for (size_t i = 0; i < n; ++i) put(y, x + (int)i, s[i]);
+        cx_ = x + (int)n;
+    }
+
+    __attribute__((format(printf, 4, 5))) void print(int y, int x, const char *fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        vprint(y, x, fmt, ap);
+        va_end(ap);
+    }
+
+    // Continues where the last print ended.
+    __attribute__((format(printf, 2, 3))) void printw(const char *fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        vprint(cy_, cx_, fmt, ap);
+        va_end(ap);
+    }
+
+private:
+    void vprint(int y, int x, const char *fmt, va_list ap) {
+        char buf[1024];
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        if (n < 0) return;
+        text(y, x, buf, std::min<size_t>((size_t)n, sizeof(buf) - 1));
+    }
+
+    Frame *f_;
+    Rect r_;
+    uint8_t attr_{ATTR_NORMAL};
+    int cy_{0}, cx_{0};
+};
+
+// Puts frames on a terminal and reads keys (as ncurses KEY_* codes, ERR when
+// none is pending). A terminal resize is reported as KEY_RESIZE, after which
+// size() returns the new dimensions.
+class Renderer {
+public:
+    virtual ~Renderer() {}
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    virtual void size(int &rows, int &cols) = 0;
+    virtual void present(const Frame &f) = 0;
+    virtual int key() = 0;
+    virtual const char *name() const = 0;
+    // Waits until `deadline` or until a key is pending, returning true in the
+    // latter case; backends with queued output use the time to send it.
+    virtual bool idle(std::chrono::steady_clock::time_point deadline) = 0;
+    // Short note for the header about the output path, empty when normal.
+    virtual std::string status() const { return std::string(); }
+};
+
+// ncurses backend: copies the frame into stdscr and lets ncurses work out
+// the update. With an explicit output stream it drives that instead of the
+// terminal (used by bench-render).
+class NcursesRenderer : public Renderer {
+public:
+    explicit NcursesRenderer(FILE *out = nullptr, FILE *in = nullptr) : out_(out), in_(in) {}
+
+    bool start() override {
+        if (out_) {
+            screen_ = newterm("xterm", out_, in_);
+            if (!screen_) return false;
+            set_term(screen_);
+            cbreak();
+            noecho();
+            nodelay(stdscr, TRUE);
+            curs_set(0);
+        } else {
+            init_screen();
+        }
+        return true;
+    }
+
+    void stop() override {
+        endwin();
+        if (screen_) delscreen(screen_);
+        screen_ = nullptr;
+    }
+
+    void size(int &rows, int &cols) override { getmaxyx(stdscr, rows, cols); }
+
+    void present(const Frame &f) override {
+        int rows, cols;
+        getmaxyx(stdscr, rows, cols);
+        std::string run;
+        for (int y = 0; y < std::min(rows, f.rows); ++y) {
+            const Cell *c = f.row(y);
+            int w = std::min(cols, f.cols);
+            for (int x = 0; x < w;) {
+                int x0 = x;
+                uint8_t a = c[x].attr;
+                run.clear();
+                while (x < w && c[x].attr == a) run += c[x++].ch;
+                attrset(a & ATTR_REVERSE ? A_REVERSE : A_NORMAL);
+                mvaddnstr(y, x0, run.data(), (int)run.size());
+            }
+        }
+        attrset(A_NORMAL);
+        refresh();
+    }
+
+    int key() override { return getch(); }
+    const char *name() const override { return "ncurses"; }
+
+    bool idle(std::chrono::steady_clock::time_point deadline) override {
+        struct pollfd pfd{in_ ? fileno(in_) : STDIN_FILENO, POLLIN, 0};
+        for (;;) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return false;
+            int ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+            int n = poll(&pfd, 1, ms);
+            // ncurses' own SIGWINCH handler interrupts the poll; getch() then
+            // returns KEY_RESIZE.
+            if (n > 0 || (n < 0 && errno == EINTR)) return true;
+        }
+    }
+
+    static void init_screen() {
+        initscr();
+        cbreak();
+        noecho();
+        nodelay(stdscr, TRUE);
+        keypad(stdscr, TRUE);
+        curs_set(0);
+    }
+
+private:
+    FILE *out_, *in_;
+    SCREEN *screen_{nullptr};
+};
+
+// Raw ANSI backend with no terminfo dependency. Each frame is diffed cell by
+// cell against the previous one; the changes are composed into one buffer of
+// cursor moves, attribute switches and text and sent with a single write().
+//
+// Output is non-blocking so a slow link never stalls sampling. Only one
+// frame is in flight at a time: frames presented meanwhile replace each
+// other, and the next diff is taken against what the terminal actually has.
+// On a terminal each frame ends with a cursor position query; the reply
+// marks the frame as displayed, so the send-to-reply time covers the whole
+// path (ssh, jump hosts) and not just the local pty. The throughput derived
+// from it spaces repaints so frames use at most half of the link.
+class AnsiRenderer : public Renderer {
+public:
+    explicit AnsiRenderer(int out_fd = STDOUT_FILENO, int in_fd = STDIN_FILENO) : out_(out_fd), in_(in_fd) {}
+
+    bool start() override {
+        if (isatty(in_) && tcgetattr(in_, &saved_) == 0) {
+            struct termios raw = saved_;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 0;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(in_, TCSANOW, &raw);
+            restore_ = true;
+        }
+        acks_ = restore_ && isatty(out_);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_winch;  // no SA_RESTART, so a resize wakes idle()
+        sigemptyset(&sa.sa_mask);
+        winch_set_ = sigaction(SIGWINCH, &sa, &saved_winch_) == 0;
+        emit("\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J");
+        out_flags_ = fcntl(out_, F_GETFL);
+        if (out_flags_ != -1) fcntl(out_, F_SETFL, out_flags_ | O_NONBLOCK);
+        prev_.cells.clear();
+        have_want_ = in_flight_ = false;
+        queries_ = answers_ = 0;
+        rate_ = 0;
+        min_rtt_ = -1;
+        return true;
+    }
+
+    void stop() override {
+        if (out_flags_ != -1) fcntl(out_, F_SETFL, out_flags_);
+        out_flags_ = -1;
+        emit(pending_.substr(pending_off_));
+        pending_.clear();
+        pending_off_ = 0;
+        // Collect the last position report so it doesn't land in the shell.
+        for (auto end = Clock::now() + std::chrono::milliseconds(500); acks_ && answers_ < queries_ && Clock::now() < end;) {
+            struct pollfd pfd{in_, POLLIN, 0};
+            if (poll(&pfd, 1, 50) > 0) read_input();
+        }
+        in_flight_ = false;
+        emit("\x1b[0m\x1b[?25h\x1b[?1049l");
+        if (restore_) {
+            tcflush(in_, TCIFLUSH);
+            tcsetattr(in_, TCSANOW, &saved_);
+        }
+        restore_ = false;
+        if (winch_set_) sigaction(SIGWINCH, &saved_winch_, nullptr);
+        winch_set_ = false;
+    }
+
+    void size(int &rows, int &cols) override {
+        struct winsize ws;
+        if (ioctl(out_, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+            rows = ws.ws_row;
+            cols = ws.ws_col;
+            return;
+        }
+        const char *r = getenv("LINES"), *c = getenv("COLUMNS");
+        rows = r && atoi(r) > 0 ? atoi(r) : 24;
+        cols = c && atoi(c) > 0 ? atoi(c) : 80;
+    }
+
+    void present(const Frame &f) override {
+        want_ = f;
+        have_want_ = true;
+        pump();
+    }
+
+    bool idle(std::chrono::steady_clock::time_point deadline) override {
+        for (;;) {
+            if (resized_) return true;
+            pump();
+            read_input();
+            if (!input_.empty() && !partial_report()) return true;
+            auto now = Clock::now();
+            if (now >= deadline) return false;
+            auto wake = deadline;
+            if (in_flight_ && acks_ && pending_.empty()) wake = std::min(wake, written_ + ACK_TIMEOUT);
+            if (have_want_ && !in_flight_) wake = std::min(wake, next_frame_);
+            struct pollfd pfd[2] = {{in_, POLLIN, 0}, {out_, POLLOUT, 0}};
+            int n = pending_.empty() ? 1 : 2;
+            int ms = std::max(0, (int)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1);
+            if (poll(pfd, n, ms) < 0 && errno == EINTR) return true;
+        }
+    }
+
+    int key() override {
+        if (resized_) {
+            resized_ = 0;
+            return KEY_RESIZE;
+        }
+        read_input();
+        if (input_.empty() || partial_report()) return ERR;
+        static const struct { const char *seq; int key; } seqs[] = {
+            {"\x1b[A", KEY_UP}, {"\x1b[B", KEY_DOWN}, {"\x1b[C", KEY_RIGHT}, {"\x1b[D", KEY_LEFT},
+            {"\x1b[5~", KEY_PPAGE}, {"\x1b[6~", KEY_NPAGE}, {"\x1b[H", KEY_HOME}, {"\x1b[F", KEY_END},
+            {"\x1b[1~", KEY_HOME}, {"\x1b[4~", KEY_END}, {"\x1bOH", KEY_HOME}, {"\x1bOF", KEY_END},
+            {"\x1bOA", KEY_UP}, {"\x1bOB", KEY_DOWN}};
+        for (auto &s : seqs) {
+            size_t n = strlen(s.seq);
+            if (input_.compare(0, n, s.seq) == 0) {
+                input_.erase(0, n);
+                return s.key;
+            }
+        }
+        int ch = (unsigned char)input_[0];
+        input_.erase(0, 1);
+        return ch == 127 ? KEY_BACKSPACE : ch;
+    }
+
+    std::string status() const override {
+        if (!constrained()) return std::string();
+        char buf[80];
+        snprintf(buf, sizeof(buf), "slow link %.1fKB/s, repaint %.1fs", rate_ / 1024, frame_s() * HEADROOM);
+        return buf;
+    }
+
+    const char *name() const override { return "ansi"; }
+    unsigned long long bytes_written() const { return bytes_; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static constexpr double HEADROOM = 2;  // repaint no more than 1/HEADROOM of the link
+    static constexpr size_t PROBE_BYTES = 256;  // frames this small time the latency, not the bandwidth
+    static constexpr std::chrono::seconds ACK_TIMEOUT{3}, ACK_LOST{60}, ACK_GIVE_UP{30};
+
+    double frame_s() const { return rate_ > 0 ? frame_bytes_ / rate_ : 0; }
+    bool constrained() const { return frame_s() * HEADROOM > 0.25; }
+
+    // Writes what the link takes, retires the frame in flight once it is
+    // written and acknowledged, and starts the newest pending frame when the
+    // pacing allows.
+    void pump() {
+        flush_some();
+        if (in_flight_ && pending_.empty()) {
+            auto now = Clock::now();
+            if (written_ == Clock::time_point()) written_ = now;
+            read_input();
+            // Replies come back in order, so the frame is on screen once its
+            // own query is answered. A terminal that has answered before is
+            // only slow and gets much longer; one that has never answered in
+            // ACK_GIVE_UP doesn't support the query.
+            bool acked = answers_ >= frame_seq_;
+            if (!acks_ || acked || now - written_ > (answers_ ? ACK_LOST : ACK_TIMEOUT)) {
+                if (acks_ && !answers_ && now - first_query_ > ACK_GIVE_UP) acks_ = false;
+                finish_frame(acked || !acks_);
+            }
+        }
+        if (in_flight_ || !have_want_ || Clock::now() < next_frame_) return;
+        out_buf_.clear();
+        compose(want_);
+        have_want_ = false;
+        if (out_buf_.empty()) return;
+        size_t frame = out_buf_.size();
+        if (acks_) {
+            out_buf_ += "\x1b[6n";
+            if (!queries_++) first_query_ = Clock::now();
+            frame_seq_ = queries_;
+        }
+        pending_.swap(out_buf_);
+        pending_off_ = 0;
+        sent_ = Clock::now();
+        written_ = Clock::time_point();
+        sent_bytes_ = frame;
+        in_flight_ = true;
+        flush_some();
+        if (pending_.empty()) written_ = sent_;
+    }
+
+    // Retires the frame in flight; `measured` when its display time is known.
+    void finish_frame(bool measured) {
+        in_flight_ = false;
+        if (!measured) {
+            next_frame_ = Clock::now();
+            return;
+        }
+        double took = std::chrono::duration<double>(Clock::now() - sent_).count();
+        // The quickest round trip of a near-empty frame approximates the link
+        // latency; what a frame takes beyond that is transmission time. Each
+        // frame is measured against the latency known before it, and one that
+        // took no longer than that says nothing about the rate.
+        double latency = std::max(0.0, min_rtt_);
+        if (took > latency) {
+            double sample = sent_bytes_ / std::max(1e-3, took - latency);
+            rate_ = rate_ > 0 ? 0.7 * rate_ + 0.3 * sample : sample;
+        }
+        if (acks_ && sent_bytes_ <= PROBE_BYTES && (min_rtt_ < 0 || took < min_rtt_)) min_rtt_ = took;
+        frame_bytes_ = frame_bytes_ > 0 ? 0.7 * frame_bytes_ + 0.3 * sent_bytes_ : sent_bytes_;
+        next_frame_ = constrained() ? sent_ + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(frame_s() * HEADROOM))
+                                    : Clock::now();
+    }
+
+    void flush_some() {
+        while (pending_off_ < pending_.size()) {
+            ssize_t n = write(out_, pending_.data() + pending_off_, pending_.size() - pending_off_);
+            if (n > 0) {
+                pending_off_ += n;
+                bytes_ += n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            } else {
+                break;  // the terminal is gone; drop the output
+            }
+        }
+        pending_.clear();
+        pending_off_ = 0;
+    }
+
+    // Moves whatever is readable into input_, taking out position reports
+    // (ESC [ row ; col R) as frame acknowledgements.
+    void read_input() {
+        struct pollfd pfd{in_, POLLIN, 0};
+        char buf[256];
+        while (poll(&pfd, 1, 0) > 0) {
+            ssize_t n = read(in_, buf, sizeof(buf));
+            if (n <= 0) break;
+            input_.append(buf, n);
+        }
+        if (!acks_) return;
+        for (size_t i = 0; (i = input_.find("\x1b[", i)) != std::string::npos;) {
+            size_t j = i + 2;
+            while (j < input_.size() && (isdigit((unsigned char)input_[j]) || input_[j] == ';')) ++j;
+            if (j < input_.size() && input_[j] == 'R' && input_.find(';', i) < j) {
+                input_.erase(i, j + 1 - i);
+                ++answers_;
+            } else {
+                i += 2;
+            }
+        }
+    }
+
+    // True while input_ holds only the start of a position report whose rest
+    // is still on the way; it must not be handed out as keys.
+    bool partial_report() const {
+        if (!acks_ || answers_ >= queries_ || input_.compare(0, 2, "\x1b[") != 0) return false;
+        for (size_t i = 2; i < input_.size(); ++i)
+            if (!isdigit((unsigned char)input_[i]) && input_[i] != ';') return false;
+        return true;
+    }
+
+    void compose(const Frame &f) {
+        if (prev_.rows != f.rows || prev_.cols != f.cols) {
+            // Diff against the blank screen left by the clear.
+            out_buf_ += "\x1b[0m\x1b[2J";
+            prev_.resize(f.rows, f.cols);
+        }
+        const Cell blank{' ', ATTR_NORMAL};
+        int cy = -1, cx = -1;
+        uint8_t attr = 0xff;
+        for (int y = 0; y < f.rows; ++y) {
+            const Cell *c = f.row(y);
+            const Cell *p = prev_.row(y);
+            int end = f.cols;  // c[end..] is blank
+            while (end > 0 && c[end - 1] == blank) --end;
+            for (int x = 0; x < f.cols; ++x) {
+                if (c[x] == p[x]) continue;
+                move(c, y, x, cy, cx, attr, f.cols);
+                if (x >= end) {
+                    // Everything from here on is blank: clear the rest of the line.
+                    if (attr != ATTR_NORMAL) {
+                        attr = ATTR_NORMAL;
+                        out_buf_ += "\x1b[0m";
+                    }
+                    out_buf_ += "\x1b[K";
+                    break;
+                }
+                if (c[x].attr != attr) {
+                    attr = c[x].attr;
+                    out_buf_ += attr & ATTR_REVERSE ? "\x1b[7m" : "\x1b[0m";
+                }
+                out_buf_ += c[x].ch;
+                cy = y;
+                cx = x + 1;
+            }
+        }
+        if (attr != 0xff && attr != ATTR_NORMAL) out_buf_ += "\x1b[0m";
+        prev_ = f;
+    }
+
+    // Shortest escape sequence from (cy, cx) to (y, x) among: staying on the
+    // row, starting the next line, a vertical-only move, each followed by a
+    // horizontal move, and an absolute position. cx == cols means the cursor
+    // sits in the pending-wrap state after the last column, where relative
+    // horizontal moves are unreliable.
+    void move(const Cell *row, int y, int x, int &cy, int &cx, uint8_t attr, int cols) {
+        if (cy == y && cx == x) return;
+        char seq[32];
+        std::string best(seq, x == 0 ? snprintf(seq, sizeof(seq), "\x1b[%dH", y + 1)
+                                     : snprintf(seq, sizeof(seq), "\x1b[%d;%dH", y + 1, x + 1));
+        std::string cand;
+        auto consider = [&]() {
+            if (cand.size() < best.size()) best = cand;
+        };
+        int from = cx < cols ? cx : -1;
+        if (cy == y) {
+            cand.clear();
+            horizontal(row, from, x, attr, cand);
+            consider();
+        }
+        if (cy >= 0 && y == cy + 1) {
+            cand = "\r\n";
+            horizontal(row, 0, x, attr, cand);
+            consider();
+        }
+        if (cy >= 0 && cy != y) {
+            cand.assign(seq, snprintf(seq, sizeof(seq), "\x1b[%dd", y + 1));
+            horizontal(row, from, x, attr, cand);
+            consider();
+        }
+        out_buf_ += best;
+        cy = y;
+        cx = x;
+    }
+
+    // Appends the shortest horizontal move from column `from` (-1: unknown)
+    // to `to` on a row whose cells before `to` are unchanged.
+    static void horizontal(const Cell *row, int from, int to, uint8_t attr, std::string &out) {
+        if (from == to) return;
+        char seq[16];
+        std::string best(seq, snprintf(seq, sizeof(seq), "\x1b[%dG", to + 1));
+        auto resend = [&](int a, std::string prefix) {
+            if (to - a > 4) return;
+            for (int g = a; g < to; ++g) {
+                if (row[g].attr != attr) return;
+                prefix += row[g].ch;
+            }
+            if (prefix.size() < best.size()) best = prefix;
+        };
+        if (to == 0) best = "\r";
+        else resend(0, "\r");
+        if (from >= 0 && to > from) {
+            resend(from, "");
+            std::string cuf(seq, snprintf(seq, sizeof(seq), "\x1b[%dC", to - from));
+            if (cuf.size() < best.size()) best = cuf;
+        } else if (from >= 0) {
+            std::string back = from - to <= 4 ? std::string(from - to, '\b')
+                                              : std::string(seq, snprintf(seq, sizeof(seq), "\x1b[%dD", from - to));
+            if (back.size() < best.size()) best = back;
+        }
+        out += best;
+    }
+
+    static void on_winch(int) { resized_ = 1; }
+
+    // Blocking write, for terminal setup and teardown.
+    void emit(const std::string &s) {
+        size_t off = 0;
+        while (off < s.size()) {
+            ssize_t n = write(out_, s.data() + off, s.size() - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += n;
+        }
+        bytes_ += off;
+    }
+
+    int out_, in_;
+    struct termios saved_;
+    bool restore_{false};
+    int out_flags_{-1};
+    struct sigaction saved_winch_;
+    bool winch_set_{false};
+    static inline volatile sig_atomic_t resized_{0};
+    Frame prev_, want_;
+    bool have_want_{false};
+    std::string out_buf_, pending_, input_;
+    size_t pending_off_{0};
+    unsigned long long bytes_{0};
+    // Frame in flight and link estimate.
+    bool acks_{false}, in_flight_{false};
+    unsigned long long queries_{0}, answers_{0}, frame_seq_{0};
+    Clock::time_point sent_, written_, next_frame_, first_query_;
+    size_t sent_bytes_{0};
+    double rate_{0}, frame_bytes_{0}, min_rtt_{-1};
+};
+
+static std::string sparkline(const MetricHistory &hist, uint32_t slot, MetricHistory::Metric m, size_t width) {
+    static const char levels[] = " .:-=+*#%@";
+    std::vector<float> buf(width);
+    size_t n = slot == NO_SLOT ? 0 : hist.read(slot, m, buf.data(), width);
+    float peak = 1.0f;
+    for (size_t i = 0; i < n; ++i) peak = std::max(peak, buf[i]);
+    std::string out(width - n, ' ');
+    for (size_t i = 0; i < n; ++i) {
+        int lvl = (int)(buf[i] / peak * 9.0f + 0.5f);
+        out += levels[std::max(0, std::min(9, lvl))];
+    }
+    return out;
+}
+
+// Column layout of the process list. It is worked out once per terminal
+// width and set of optional columns: when the columns don't fit, the least
+// important ones are dropped first, and CMD gets all the width that is
+// left. The header line and each column's position and format are kept
+// until either changes.
+class ProcLayout {
+public:
+    enum Col { PID, CPU, CHILD, MEM, RSS, AVG1, AVG10, AVG60, ANOM, IPC, MPKI, ONCPU, CSW, HISTORY, CMD, NUM_COLS };
+
+    // Optional columns, off unless their bit (1 << Col) is in `optional`.
+    static const unsigned OPTIONAL_COLS = 1u << IPC | 1u << MPKI | 1u << ONCPU | 1u << CSW;
+
+    // Recomputes the layout for `width` columns; returns at once when
+    // nothing changed since the last call.
+    void fit(int width, unsigned optional = 0) {
+        optional &= OPTIONAL_COLS;
+        if (width == width_ && optional == optional_) return;
+        width_ = width;
+        optional_ = optional;
+        bool shown[NUM_COLS];
+        for (int c = 0; c < NUM_COLS; ++c) shown[c] = !(OPTIONAL_COLS >> c & 1) || (optional >> c & 1);
+        int used = 0;
+        for (int c = 0; c < CMD; ++c)
+            if (shown[c]) used += specs[c].width + 1;
+        // Drop columns by rank until CMD has room for a readable name.
+        for (int rank = 1; rank < NUM_COLS && used + 1 + MIN_CMD > width; ++rank)
+            for (int c = 0; c < CMD; ++c)
+                if (shown[c] && specs[c].drop == rank) {
+                    shown[c] = false;
+                    used -= specs[c].width + 1;
+                }
+        fields_.clear();
+        header_.assign(width_ > 0 ? width_ : 0, ' ');
+        int x = 0;
+        for (int c = 0; c < NUM_COLS; ++c) {
+            if (!shown[c]) continue;
+            if (c == CMD) ++x;  // two spaces ahead of the command
+            if (x >= width_) break;
+            int w = c == CMD ? width_ - x : std::min(specs[c].width, width_ - x);
+            fields_.push_back(Field{(Col)c, x, w});
+            int n = (int)strlen(specs[c].title);
+            int tx = specs[c].right ? x + w - n : x;
+            for (int k = 0; k < n && tx + k < width_; ++k)
+                if (tx + k >= 0) header_[tx + k] = specs[c].title[k];
+            x += w + 1;
+        }
+    }
+
+    int width() const { return width_; }
+    const std::string &header() const { return header_; }
+
+    // Formats one process into `line` (width() characters).
+    void format(const ProcInfo &p, const MetricHistory &hist, std::string &line) const {
+        static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+        line.assign(width_ > 0 ? width_ : 0, ' ');
+        char buf[64];
+        for (const Field &f : fields_) {
+            int n = 0;
+            switch (f.col) {
+            case PID: n = put_int(buf, p.pid, f.w) - buf; break;
+            case CPU: n = put_fixed(buf, p.cpu_percent, 2, f.w) - buf; break;
+            case CHILD: n = put_fixed(buf, p.child_cpu_percent, 2, f.w) - buf; break;
+            case MEM: n = put_fixed(buf, p.mem_percent, 2, f.w) - buf; break;
+            case RSS: n = put_int(buf, p.rss * page_size_kb, f.w) - buf; break;
+            case AVG1: case AVG10: case AVG60: n = put_fixed(buf, p.cpu_avg[f.col - AVG1], 2, f.w) - buf; break;
+            case ANOM:
+                n = put_fixed(buf, p.anomaly, 1, f.w - 1) - buf;
+                buf[n++] = p.anomaly_metric;
+                break;
+            case IPC:
+                if (p.ipc < 0) continue;
+                n = put_fixed(buf, p.ipc, 2, f.w) - buf;
+                break;
+            case MPKI:
+                if (p.mpki < 0) continue;
+                n = put_fixed(buf, p.mpki, 2, f.w) - buf;
+                break;
+            case ONCPU:
+                if (p.oncpu_percent < 0) continue;
+                n = put_fixed(buf, p.oncpu_percent, 2, f.w) - buf;
+                break;
+            case CSW:
+                if (p.csw_per_s < 0) continue;
+                n = put_fixed(buf, p.csw_per_s, 0, f.w) - buf;
+                break;
+            case HISTORY: {
+                std::string spark = sparkline(hist, p.slot, MetricHistory::CPU, f.w);
+                line.replace(f.x, f.w, spark);
+                continue;
+            }
+            case CMD:
+                line.replace(f.x, std::min<size_t>(f.w, p.cmd.size()), p.cmd, 0, f.w);
+                continue;
+            default: break;
+            }
+            line.replace(f.x, f.w, buf, std::min(std::max(n, 0), f.w));
+        }
+    }
+
+private:
+    static const int MIN_CMD = 16;
+    struct Spec {
+        const char *title;
+        int width;
+        int drop;  // order in which columns go when space runs out; 0 = never
+        bool right;
+    };
+    static constexpr Spec specs[NUM_COLS] = {
+        {"PID", 7, 0, true},      {"CPU%", 7, 0, true},     {"CHLD%", 7, 1, true},   {"MEM%", 8, 6, true},
+        {"RSS(KB)", 10, 0, true}, {"AVG1s", 7, 7, true},    {"AVG10s", 7, 3, true},  {"AVG60s", 7, 2, true},
+        {"ANOM", 6, 4, true},     {"IPC", 5, 10, true},     {"MISS/KI", 7, 9, true}, {"ONCPU%", 7, 10, true},
+        {"CSW/s", 7, 8, true},    {"HISTORY", 10, 5, false}, {"CMD", 0, 0, false}};
+
+    struct Field {
+        Col col;
+        int x, w;
+    };
+    std::vector<Field> fields_;
+    int width_{-1};
+    unsigned optional_{0};
+    std::string header_;
+};
+
+void draw_header(Canvas &w, const ProcLayout &layout, const SystemSnapshot &snap, const CpuAccounting &acct,
+                 SortKey sort_key, const AlertEngine &alerts, const std::string &note) {
+    w.erase();
+    w.print(0, 0, " SysMon - Simple System Monitor (q:quit  s:sort %s  k:kill PID  r:refresh time  e:events [ ] scroll  d:detail  w:watch  l:leaks  n:numa  c:cpus  t:throttling  g:goto pid) ",
+              sort_key_names[sort_key]);
+    w.print(1, 0, " CPUs: %d | Total Jiffies: %llu | MemTotal: %lu KB | Unaccounted CPU: %.2f%% | Reaped: %.2f%% | IRQ: %.2f%% | Steal: %.2f%% | +%d -%d ",
+              snap.num_cpus, snap.total_jiffies, snap.mem_total_kb, acct.unaccounted_percent, acct.reaped_percent,
+              acct.irq_percent, acct.steal_percent, acct.born, acct.exited);
+    if (!alerts.empty()) w.printw("| Alerts: %zu firing (%.0f us) ", alerts.firing(), alerts.last_eval_us());
+    if (!note.empty()) w.printw("| %s ", note.c_str());
+    w.text(2, 0, layout.header().data(), layout.header().size());
+}
+
+// Selection in the sorted process list. The selected process is remembered
+// by key so the cursor stays on it when the list is re-sorted; `top` is the
+// first visible row. Moving the cursor is O(1) whatever the list size.
+struct ListCursor {
+    int sel{0}, top{0};
+    ProcKey key;
+
+    // Finds the selected process again after a new tick. If it has exited
+    // the cursor keeps its index and picks up whatever is there now.
+    void follow(const std::vector<ProcInfo> &plist) {
+        for (size_t i = 0; i < plist.size(); ++i)
+            if (plist[i].key() == key) {
+                sel = (int)i;
+                return;
+            }
+        move_to(sel, plist);
+    }
+
+    void move_to(int i, const std::vector<ProcInfo> &plist) {
+        sel = std::max(0, std::min(i, (int)plist.size() - 1));
+        if (!plist.empty()) key = plist[sel].key();
+    }
+
+    // Scrolls the least amount that keeps the selection on screen.
+    void keep_visible(int height, int size) {
+        if (sel < top) top = sel;
+        else if (sel >= top + height) top = sel - height + 1;
+        top = std::max(0, std::min(top, size - height));
+    }
+};
+
+void draw_processes(Canvas &w, const ProcLayout &layout, const std::vector<ProcInfo> &plist, int start,
+                    int height, const MetricHistory &hist, int highlight) {
+    w.erase();
+    std::string line;
+    int row = 0;
+    for (int i = start; i < (int)plist.size() && row < height; ++i, ++row) {
+        layout.format(plist[i], hist, line);
+        if (i == highlight) w.reverse(true);
+        w.text(row, 0, line.data(), line.size());
+        if (i == highlight) w.reverse(false);
+    }
+}
+
+void draw_detail(Canvas &w, const ProcInfo &p, const MetricHistory &hist, const ProcTable &table) {
+    w.erase();
+    w.box();
+    int h = w.rows(), width = w.cols();
+    bool valid = table.valid(p.slot, p.generation);
+    w.print(0, 2, " PID %d%s  %.40s ", p.pid, valid && !table.live(p.slot) ? " (exited)" : "", p.cmd.c_str());
+    if (!valid) {
+        w.print(1, 1, "history evicted");
+        return;
+    }
+
+    size_t chart_w = std::min<size_t>(hist.depth(), width > 12 ? width - 12 : 1);
+    int chart_h = h - 6;
+    std::vector<float> cpu(chart_w);
+    size_t n = hist.read(p.slot, MetricHistory::CPU, cpu.data(), chart_w);
+    float peak = 1.0f;
+    for (size_t i = 0; i < n; ++i) peak = std::max(peak, cpu[i]);
+    for (int r = 0; r < chart_h; ++r) {
+        float thresh = peak * (float)(chart_h - r) / (float)chart_h;
+        if (r == 0) w.print(1 + r, 1, "%7.1f%%", peak);
+        else if (r == chart_h - 1) w.print(1 + r, 1, "%7.1f%%", 0.0);
+        for (size_t i = 0; i < n; ++i)
+            w.put(1 + r, 10 + (int)(chart_w - n + i), cpu[i] >= thresh - peak / (2.0f * chart_h) && cpu[i] > 0 ? '#' : ' ');
+    }
+
+    static const char *names[] = {"CPU%", "RSS KB", "IO KB/s", "Faults/s"};
+    int row = 1 + chart_h;
+    for (int m = MetricHistory::RSS_KB; m < MetricHistory::NUM_METRICS && row < h - 1; ++m, ++row) {
+        std::vector<float> v(hist.depth());
+        size_t k = hist.read(p.slot, (MetricHistory::Metric)m, v.data(), v.size());
+        float lo = 0, hi = 0, sum = 0;
+        if (k) lo = hi = v[0];
+        for (size_t i = 0; i < k; ++i) { lo = std::min(lo, v[i]); hi = std::max(hi, v[i]); sum += v[i]; }
+        std::string spark = sparkline(hist, p.slot, (MetricHistory::Metric)m, 20);
+        w.print(row, 1, "%-8s min %10.1f  avg %10.1f  max %10.1f  %s", names[m], lo, k ? sum / k : 0.0f, hi, spark.c_str());
+    }
+}
+
+void draw_leaks(Canvas &w, const LeakDetector &leaks, const SlotMetrics &m, const ProcTable &table,
+                const SystemSnapshot &snap) {
+    w.erase();
+    w.box();
+    w.print(0, 2, " Suspected leaks (RSS trend, MemAvailable %lu KB) ", snap.mem_available_kb);
+    w.print(1, 1, "%7s %12s %12s %6s %8s %10s  %s", "PID", "RSS(KB)", "GROWTH MB/h", "R2", "FIT", "EXHAUSTS", "CMD");
+    int row = 2;
+    for (const LeakReport &r : leaks.reports()) {
+        if (row >= w.rows() - 1) break;
+        const ProcInfo *p = m.info[r.slot];
+        double eta = snap.mem_available_kb / r.slope_kb_s;
+        w.print(row++, 1, "%7d %12.0f %12.1f %6.2f %8s %10s  %.40s", table.key(r.slot).pid, r.rss_kb,
+                  r.slope_kb_s * 3600.0 / 1024.0, r.r2, format_duration(r.span_s).c_str(),
+                  format_duration(eta).c_str(), p ? p->cmd.c_str() : "");
+    }
+    if (leaks.reports().empty()) w.print(2, 1, "no process with sustained RSS growth");
+}
+
+// Per-node memory and allocation counters, then the processes whose memory
+// mostly sits on nodes their threads are not running on.
+void draw_numa(Canvas &w, const NumaMonitor &numa) {
+    w.erase();
+    w.box();
+    if (!numa.available()) {
+        w.print(0, 2, " NUMA ");
+        w.print(1, 1, "no NUMA topology under /sys/devices/system/node");
+        return;
+    }
+    w.print(0, 2, " NUMA: %zu node(s), numa_maps of %zu process(es) read in %.1f ms ", numa.nodes().size(),
+            numa.sampled(), numa.sample_ms());
+    int row = 1;
+    for (const NumaMonitor::Node &n : numa.nodes()) {
+        if (row >= w.rows() - 1) return;
+        double total = n.hit_per_s + n.miss_per_s;
+        w.print(row++, 1, "node%-3d MemTotal %10lu KB  MemFree %10lu KB  numa_hit %9.0f/s  numa_miss %9.0f/s (%.1f%%)",
+                n.id, n.mem_total_kb, n.mem_free_kb, n.hit_per_s, n.miss_per_s,
+                total > 0 ? n.miss_per_s / total * 100.0 : 0.0);
+    }
+    if (row >= w.rows() - 1) return;
+    w.print(row++, 1, "%7s %-12s %-28s %8s  %s", "PID", "THREAD NODES", "MEMORY BY NODE", "REMOTE%", "CMD");
+    for (const NumaMonitor::Report &r : numa.reports()) {
+        if (row >= w.rows() - 1) break;
+        std::string threads, mem;
+        for (size_t i = 0; i < numa.nodes().size(); ++i) {
+            if (r.pl.thread_nodes >> i & 1) threads += (threads.empty() ? "" : ",") + std::to_string(numa.nodes()[i].id);
+            if (r.pl.node_kb[i] * 20 >= r.pl.total_kb)  // nodes holding 5% or more
+                mem += "N" + std::to_string(numa.nodes()[i].id) + " " +
+                       std::to_string(r.pl.node_kb[i] * 100 / r.pl.total_kb) + "% ";
+        }
+        w.print(row++, 1, "%7d %-12.12s %-28.28s %7.1f%%  %.*s", r.pid, threads.c_str(), mem.c_str(),
+                r.pl.remote_kb * 100.0 / r.pl.total_kb, std::max(0, w.cols() - 63), r.cmd.c_str());
+    }
+    if (numa.reports().empty() && row < w.rows() - 1)
+        w.print(row, 1, numa.nodes().size() < 2 ? "single node: no memory is remote"
+                                                : "no sampled process has most of its memory away from its threads' nodes");
+}
+
+// One row per hot process, one column per CPU: ' ' where its affinity
+// mask forbids the core, '.' where allowed but unused, and rising heat
+// otherwise. The last row sums the hot processes' CPU% per core, with '!'
+// where that passes 100%.
+void draw_cpu_placement(Canvas &w, const CpuPlacement &pl) {
+    static const char heat_levels[] = ":-=+*#%@";
+    w.erase();
+    w.box();
+    w.print(0, 2, " CPU placement of the busiest processes (%d CPUs) ", pl.ncpus());
+    const int map_x = 47;
+    w.print(1, 1, "%7s %6s %7s %-10s %-12s", "PID", "CPU%", "MIGR/s", "LAST CPU", "AFFINITY");
+    for (int c = 0; c < pl.ncpus(); ++c) w.put(1, map_x + c, (char)('0' + c % 10));
+    int row = 2;
+    for (const CpuPlacement::Row &r : pl.rows()) {
+        if (row >= w.rows() - 2) break;
+        char aff[24];
+        if (pl.restricted(r)) snprintf(aff, sizeof(aff), "%d cpu%s", r.allowed_count, r.allowed_count > 1 ? "s" : "");
+        else snprintf(aff, sizeof(aff), "any");
+        w.print(row, 1, "%7d %6.1f %7.1f %-10d %-12s", r.key.pid, r.cpu_percent, r.migrations_per_s, r.last_cpu, aff);
+        float peak = *std::max_element(r.heat.begin(), r.heat.end());
+        for (int c = 0; c < pl.ncpus(); ++c) {
+            char ch = ' ';
+            if (r.allowed[c]) {
+                int lvl = peak > 0 ? (int)(r.heat[c] / peak * 7.0f + 0.5f) : 0;
+                ch = r.heat[c] > 0 && peak > 0 ? heat_levels[std::max(0, std::min(7, lvl))] : '.';
+            }
+            w.put(row, map_x + c, ch);
+        }
+        w.print(row, map_x + pl.ncpus() + 1, "%.*s", std::max(0, w.cols() - map_x - pl.ncpus() - 2), r.cmd.c_str());
+        ++row;
+    }
+    if (pl.rows().empty()) w.print(row, 1, "no process used CPU in the last interval");
+    int last = w.rows() - 2;
+    w.print(last, 1, "%-45s", "core load from these processes");
+    for (int c = 0; c < pl.ncpus(); ++c) {
+        double load = pl.core_load()[c];
+        int lvl = (int)(load / 100.0 * 7.0 + 0.5);
+        w.put(last, map_x + c, load > 100.0 ? '!' : load > 0 ? heat_levels[std::max(0, std::min(7, lvl))] : '.');
+    }
+}
+
+// Cgroups ranked by CPU time held back by their quota in the last interval.
+// QUOTA and USED are in CPUs, THR% is the share of elapsed periods that
+// ended throttled.
+void draw_throttle(Canvas &w, const CgroupThrottle &th) {
+    w.erase();
+    w.box();
+    if (!th.available()) {
+        w.print(0, 2, " CPU throttling by cgroup ");
+        w.print(1, 1, "no cgroup hierarchy with the cpu controller is mounted");
+        return;
+    }
+    w.print(0, 2, " CPU throttling by cgroup (v%d at %s, %zu groups, %zu with a quota) ", th.version(),
+            th.root().c_str(), th.groups(), th.with_quota());
+    w.print(1, 1, "%7s %7s %6s %7s %5s %9s  %s", "QUOTA", "USED", "UTIL%", "THROTLD", "THR%", "THR ms", "CGROUP");
+    int row = 2;
+    for (const CgroupThrottle::Row &r : th.rows()) {
+        if (row >= w.rows() - 1) break;
+        if (r.quota_cpus < 0 && !r.throttled && r.used_cpus < 0.005) continue;  // idle and unlimited
+        char quota[16] = "max", util[16] = "-";
+        if (r.quota_cpus >= 0) {
+            snprintf(quota, sizeof(quota), "%.2f", r.quota_cpus);
+            snprintf(util, sizeof(util), "%.1f", r.util_percent);
+        }
+        w.print(row, 1, "%7s %7.2f %6s %7llu %5.1f %9.1f  %.*s", quota, r.used_cpus, util, r.throttled,
+                r.throttled_percent, r.throttled_ms, std::max(0, w.cols() - 51), r.path.c_str());
+        ++row;
+    }
+    if (row == 2)
+        w.print(row, 1, "%s", !th.groups() ? "no cgroups below the root"
+                              : th.rows().empty() ? "waiting for a second sample" : "no cgroup used CPU or has a quota");
+}
+
+void draw_events(Canvas &w, const EventLog &log, bool connector_ok, int height, size_t scroll,
+                 unsigned long long dropped) {
+    w.erase();
+    w.box();
+    w.print(0, 2, connector_ok ? " Events (proc connector) " : " Events (proc connector unavailable) ");
+    if (scroll) w.printw("[-%zu] ", scroll);
+    if (dropped) w.printw("[%llu dropped] ", dropped);
+    auto lines = log.window(height > 2 ? height - 2 : 0, scroll);
+    int row = 1;
+    for (auto &l : lines) w.print(row++, 1, "%.*s", w.cols() - 2, l.c_str());
+}
+
+// Set from SIGINT/SIGTERM so exporters get flushed and closed on the way out.
+static volatile sig_atomic_t g_quit = 0;
+
+static void on_quit_signal(int) { g_quit = 1; }
+
+// High-rate sampler for a handful of pids. stat, schedstat and io stay open
+// and are re-read with pread, so a sample costs three syscalls per process
+// and nothing else under /proc is touched. CPU comes from schedstat, which
+// counts in nanoseconds; stat's utime/stime only move once per clock tick.
+class Watcher {
+public:
+    static const size_t DEPTH = 6000;  // one minute at 100 Hz
+    enum Series { CPU, WAIT, IO_KBS, NUM_SERIES };
+
+    struct Target {
+        int pid{0};
+        std::string comm;
+        int stat_fd{-1}, sched_fd{-1}, io_fd{-1};
+        bool alive{true};
+        double last_s{0};
+        uint64_t run_ns{0}, wait_ns{0}, io_bytes{0};
+        long rss_pages{0};
+        std::vector<float> ring[NUM_SERIES];
+        size_t n{0};
+    };
+
+    ~Watcher() {
+        for (auto &t : targets_)
+            for (int fd : {t.stat_fd, t.sched_fd, t.io_fd})
+                if (fd >= 0) close(fd);
+    }
+
+    bool add(int pid) {
+        Target t;
+        t.pid = pid;
+        std::string dir = g_proc_root + "/" + std::to_string(pid) + "/";
+        t.stat_fd = open((dir + "stat").c_str(), O_RDONLY | O_CLOEXEC);
+        if (t.stat_fd < 0) return false;
+        t.sched_fd = open((dir + "schedstat").c_str(), O_RDONLY | O_CLOEXEC);
+        t.io_fd = open((dir + "io").c_str(), O_RDONLY | O_CLOEXEC);  // other users' io needs ptrace access
+        std::ifstream f(dir + "comm");
+        std::getline(f, t.comm);
+        for (auto &r : t.ring) r.assign(DEPTH, 0.0f);
+        targets_.push_back(std::move(t));
+        read(targets_.back(), now_s());
+        return true;
+    }
+
+    void sample() {
+        struct timespec a, b;
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        double now = a.tv_sec + a.tv_nsec / 1e9;
+        for (auto &t : targets_) {
+            if (!t.alive) continue;
+            double dt = now - t.last_s;
+            uint64_t run = t.run_ns, wait = t.wait_ns, io = t.io_bytes;
+            if (!read(t, now) || dt <= 0) continue;
+            size_t pos = t.n++ % DEPTH;
+            t.ring[CPU][pos] = (float)((t.run_ns - run) / 1e9 / dt * 100.0);
+            t.ring[WAIT][pos] = (float)((t.wait_ns - wait) / 1e9 / dt * 100.0);
+            t.ring[IO_KBS][pos] = (float)((t.io_bytes - io) / 1024.0 / dt);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        cost_us_ = (b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) / 1e3;
+        ++samples_;
+    }
+
+    // Most recent n samples of a series, oldest first.
+    size_t recent(const Target &t, Series s, float *out, size_t n) const {
+        n = std::min({n, t.n, DEPTH});
+        for (size_t i = 0; i < n; ++i) out[i] = t.ring[s][(t.n - n + i) % DEPTH];
+        return n;
+    }
+
+    // p50/p90/p99/max over the retained window.
+    void percentiles(const Target &t, Series s, float out[4]) const {
+        std::vector<float> v(std::min(t.n, DEPTH));
+        recent(t, s, v.data(), v.size());
+        if (v.empty()) {
+            std::fill(out, out + 4, 0.0f);
+            return;
+        }
+        static const double q[3] = {0.50, 0.90, 0.99};
+        for (int i = 0; i < 3; ++i) {
+            auto k = v.begin() + (size_t)(q[i] * (v.size() - 1));
+            std::nth_element(v.begin(), k, v.end());
+            out[i] = *k;
+        }
+        out[3] = *std::max_element(v.begin(), v.end());
+    }
+
+    const std::vector<Target> &targets() const { return targets_; }
+    double cost_us() const { return cost_us_; }
+    unsigned long long samples() const { return samples_; }
+
+    static double now_s() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+private:
+    static ssize_t reread(int fd, char *buf, size_t cap) {
+        if (fd < 0) return -1;
+        ssize_t n = pread(fd, buf, cap - 1, 0);
+        if (n >= 0) buf[n] = 0;
+        return n;
+    }
+
+    // False once the process is gone (reads on its fds fail with ESRCH).
+    bool read(Target &t, double now) {
+        char buf[1024];
+        if (reread(t.stat_fd, buf, sizeof(buf)) <= 0) {
+            t.alive = false;
+            return false;
+        }
+        const char *p = strrchr(buf, ')');
+        if (p) {
+            // rss is the 22nd field after the command
+            p += 2;
+            for (int i = 0; i < 21 && p; ++i) {
+                p = strchr(p, ' ');
+                if (p) ++p;
+            }
+            if (p) t.rss_pages = strtol(p, nullptr, 10);
+        }
+        if (reread(t.sched_fd, buf, sizeof(buf)) > 0) {
+            char *end;
+            t.run_ns = strtoull(buf, &end, 10);
+            t.wait_ns = strtoull(end, nullptr, 10);
+        }
+        if (reread(t.io_fd, buf, sizeof(buf)) > 0) {
+            uint64_t total = 0;
+            for (const char *key : {"read_bytes: ", "write_bytes: "}) {
+                const char *q = strstr(buf, key);
+                if (q) total += strtoull(q + strlen(key), nullptr, 10);
+            }
+            t.io_bytes = total;
+        }
+        t.last_s = now;
+        return true;
+    }
+
+    std::vector<Target> targets_;
+    double cost_us_{0};
+    unsigned long long samples_{0};
+};
+
+static void draw_watch_target(Canvas &w, const Watcher &watcher, const Watcher::Target &t, size_t zoom) {
+    static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+    w.erase();
+    w.box();
+    int h = w.rows(), width = w.cols();
+    float cpu[4], wait[4], io[4];
+    watcher.percentiles(t, Watcher::CPU, cpu);
+    watcher.percentiles(t, Watcher::WAIT, wait);
+    watcher.percentiles(t, Watcher::IO_KBS, io);
+    w.print(0, 2, " %d %.30s%s  RSS %ld KB ", t.pid, t.comm.c_str(), t.alive ? "" : " (exited)",
+              t.rss_pages * page_size_kb);
+    w.print(1, 1, "CPU%%  p50 %6.1f  p90 %6.1f  p99 %6.1f  max %6.1f  | runq wait%% p50 %5.1f p99 %5.1f"
+              "  | IO KB/s p50 %.0f p99 %.0f", cpu[0], cpu[1], cpu[2], cpu[3], wait[0], wait[2], io[0], io[2]);
+
+    // One column per `zoom` samples (their max), newest on the right.
+    int chart_h = h - 3;
+    size_t chart_w = width > 11 ? width - 11 : 1;
+    std::vector<float> raw(chart_w * zoom);
+    size_t n = watcher.recent(t, Watcher::CPU, raw.data(), raw.size()) / zoom;
+    std::vector<float> col(n);
+    float peak = 1.0f;
+    for (size_t i = 0; i < n; ++i) {
+        col[i] = *std::max_element(raw.begin() + i * zoom, raw.begin() + (i + 1) * zoom);
+        peak = std::max(peak, col[i]);
+    }
+    for (int r = 0; r < chart_h; ++r) {
+        float thresh = peak * (float)(chart_h - r) / (float)chart_h;
+        if (r == 0) w.print(2 + r, 1, "%7.1f%%", peak);
+        else if (r == chart_h - 1) w.print(2 + r, 1, "%7.1f%%", 0.0);
+        for (size_t i = 0; i < n; ++i)
+            w.put(2 + r, 10 + (int)(chart_w - n + i),
+                     col[i] >= thresh - peak / (2.0f * chart_h) && col[i] > 0 ? '#' : ' ');
+    }
+}
+
+// Samples only the given pids at `hz` until 'q'. The screen is redrawn at
+// about 10 fps; sampling runs on absolute deadlines so drawing does not skew
+// the rate. Returns false if none of the pids could be opened.
+static bool run_watch(Renderer &screen, const std::vector<int> &pids, int hz) {
+    Watcher watcher;
+    for (int pid : pids) watcher.add(pid);
+    if (watcher.targets().empty()) return false;
+
+    const long period_ns = 1000000000L / hz;
+    size_t zoom = 1;
+    Frame frame;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    double next_draw = 0, rate_from = Watcher::now_s();
+    unsigned long long rate_base = 0;
+    double rate = 0;
+    while (!g_quit) {
+        next.tv_nsec += period_ns;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+        watcher.sample();
+
+        double now = Watcher::now_s();
+        if (now < next_draw) continue;
+        next_draw = now + 0.1;
+        if (now - rate_from >= 1.0) {
+            rate = (watcher.samples() - rate_base) / (now - rate_from);
+            rate_base = watcher.samples();
+            rate_from = now;
+        }
+        int rows, cols;
+        screen.size(rows, cols);
+        frame.resize(rows, cols);
+        int k = (int)watcher.targets().size();
+        int ph = std::max(5, (rows - 1) / k);
+        for (int i = 0; i < k; ++i) {
+            Canvas pane(frame, Rect{i * ph, 0, ph, cols});
+            draw_watch_target(pane, watcher, watcher.targets()[i], zoom);
+        }
+        Canvas status(frame, Rect{rows - 1, 0, 1, cols});
+        status.print(0, 0, " watch: %.0f Hz (target %d), %.1f us per sample, %zu sample(s)/column  "
+                     "q:back  +/-:zoom ", rate, hz, watcher.cost_us(), zoom);
+        screen.present(frame);
+
+        int ch = screen.key();
+        if (ch == 'q' || ch == 'Q' || ch == 27) break;
+        else if (ch == '+' && zoom > 1) zoom /= 2;
+        else if (ch == '-' && zoom < 64) zoom *= 2;
+
+        // Deadlines missed by more than a period are dropped rather than replayed in a burst.
+        struct timespec cur;
+        clock_gettime(CLOCK_MONOTONIC, &cur);
+        if ((cur.tv_sec - next.tv_sec) * 1000000000L + (cur.tv_nsec - next.tv_nsec) > period_ns) next = cur;
+    }
+    return true;
+}
+
+static std::unique_ptr<Renderer> make_renderer(const std::string &name) {
+    if (name == "ansi") return std::unique_ptr<Renderer>(new AnsiRenderer());
+    return std::unique_ptr<Renderer>(new NcursesRenderer());
+}
+
+static long self_status_kb(const char *key) {
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    size_t n = strlen(key);
+    while (std::getline(f, line))
+        if (line.compare(0, n, key) == 0) return atol(line.c_str() + n + 1);
+    return 0;
+}
+
+struct EmergencyState {
+    bool active{false};
+    long locked_kb{0};  // VmLck afterwards; 0 if locking was refused
+    int nice{0};
+    bool oom_protected{false};
+};
+
+// Makes the monitor itself hard to starve: the heap is grown up front and
+// kept (no trimming, no mmap'd chunks, a single arena) and then locked, so
+// later allocations do not fault under memory pressure; the process is
+// reniced and excluded from the OOM killer when permitted. Every step is
+// best effort. Only what is mapped now is locked: with MCL_FUTURE every
+// later mapping (thread stacks, the retention and checkpoint files, heap
+// growth past the reserve) would count against RLIMIT_MEMLOCK and fail
+// once it is reached. When the whole process does not fit the limit, just
+// the reserve is locked.
+static EmergencyState enter_emergency_mode(size_t reserve_mb) {
+    EmergencyState e;
+    e.active = true;
+    mallopt(M_ARENA_MAX, 1);
+    mallopt(M_MMAP_THRESHOLD, 256 * 1024 * 1024);
+    mallopt(M_TRIM_THRESHOLD, -1);
+    size_t bytes = reserve_mb << 20;
+    if (char *p = (char *)malloc(bytes)) {
+        for (size_t i = 0; i < bytes; i += 4096) p[i] = 0;
+        struct rlimit rl;
+        size_t limit = getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? rl.rlim_cur : SIZE_MAX;
+        // Freed chunks stay mapped (no trimming), so the locked pages remain
+        // in the heap for later allocations.
+        if (mlockall(MCL_CURRENT) != 0) {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            char *start = (char *)(((uintptr_t)p + page - 1) & ~(uintptr_t)(page - 1));
+            size_t len = std::min<size_t>(p + bytes - start, limit) & ~(page - 1);
+            mlock(start, len);
+        }
+        free(p);
+    }
+    e.locked_kb = self_status_kb("VmLck:");
+    for (int n = -20; n < 0; n += 5)
+        if (setpriority(PRIO_PROCESS, 0, n) == 0) {
+            e.nice = n;
+            break;
+        }
+    int fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        e.oom_protected = write(fd, "-1000", 5) == 5;
+        close(fd);
+    }
+    return e;
+}
+
+static std::string scan_note(const EmergencyState &e, const ScanStats &scan, size_t cap) {
+    char buf[160];
+    int len = 0;
+    buf[0] = 0;
+    if (e.active)
+        len = snprintf(buf, sizeof(buf), "EMERGENCY locked %ldMB nice %d%s", e.locked_kb / 1024, e.nice,
+                       e.oom_protected ? " oom-exempt" : "");
+    if (scan.carried || scan.failed)
+        snprintf(buf + len, sizeof(buf) - len, "%sparsed %zu/%zu (cap %zu, %zu read failures)", len ? " | " : "",
+                 scan.parsed, scan.listed, cap, scan.failed);
+    return buf;
+}
+
+struct Options {
+    std::string retain_path;
+    uint32_t retain_series{512};
+    uint32_t retain_top{128};
+    std::string record_path;
+    std::string trace_path;
+    std::string arrow_path;
+    size_t arrow_batch{10};
+    std::vector<std::string> alert_rules;
+    std::vector<std::string> alert_files;
+    std::string alert_out;
+    std::vector<int> watch_pids;
+    int watch_hz{100};
+    bool emergency{false};
+    size_t max_procs{0};  // 0: unlimited, or 4096 in emergency mode
+    size_t reserve_mb{32};
+    std::string proc_root;
+    unsigned collector_threads{1};
+    std::string renderer{"ncurses"};
+    std::string state_path;
+    int state_interval{60};
+    size_t counters{0};
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "       %s query FILE [query options]\n"
+            "       %s export-trace RECORDING OUT.json\n"
+            "       %s bench-scale [bench options]\n"
+            "       %s bench-render [--procs N] [--frames N] [--rows N] [--cols N]\n"
+            "       %s bench-format [--rows N]\n"
+            "  --retain FILE          keep downsampled history in FILE (1s/1h, 10s/1d, 1min/30d)\n"
+            "  --retain-series N      number of series the retention file holds (default 512)\n"
+            "  --retain-top N         keep series for the top N processes by CPU and by memory (default 128)\n"
+            "  --record FILE          append every tick to FILE (time index in FILE.idx)\n"
+            "  --trace FILE           stream a Chrome/Perfetto JSON trace of every tick to FILE\n"
+            "  --arrow FILE           write every tick to FILE as an Arrow IPC stream\n"
+            "  --arrow-batch N        ticks per Arrow record batch (default 10)\n"
+            "  --alert RULE           e.g. \"hot: cpu > 90 for 60s clear 80\" or \"rss_rate > 100MB/min for 5m\"\n"
+            "                         metrics: cpu mem rss rss_rate io faults avg1 avg10 avg60\n"
+            "  --alert-rules FILE     one rule per line, # comments\n"
+            "  --alert-out DEST       stderr, unix:/path (datagram socket) or a file to append to\n"
+            "  -p PID[,PID...]        watch only these processes at high rate (also 'w' on the selected row)\n"
+            "  --hz N                 watch sampling rate, 1-100 (default 100)\n"
+            "  --emergency            lock memory, raise priority and bound per-tick work for hosts in trouble\n"
+            "  --max-procs N          parse at most N processes per tick, sampling the rest (emergency default 4096)\n"
+            "  --reserve-mb N         heap preallocated and locked in emergency mode (default 32)\n"
+            "  --proc-root DIR        read processes from DIR instead of /proc\n"
+            "  --collector-threads N  parse /proc with N threads (default 1)\n"
+            "  --renderer NAME        ncurses (default) or ansi: raw escape sequences, one write per frame\n"
+            "  --state FILE           checkpoint counters and history to FILE and resume from it on restart\n"
+            "  --state-interval S     seconds between checkpoints besides the one on exit (default 60)\n"
+            "  --counters N           perf counters for the top N processes: IPC, cache misses per 1000\n"
+            "                         instructions, context switches/s (time on CPU from the task clock\n"
+            "                         instead of IPC without a PMU)\n"
+            "query options:\n"
+            "  --from T --to T        time range: epoch seconds, HH:MM[:SS] today, YYYY-MM-DDTHH:MM[:SS], or -30m/-2h\n"
+            "  --top N                number of rows (default 20)\n"
+            "  --by cpu|rss           rank by CPU-seconds or peak RSS (default cpu)\n"
+            "  --per proc|cmd         aggregate per (pid, starttime) or per command (default proc)\n"
+            "  --threads N            scan threads (default: hardware concurrency)\n"
+            "bench options:\n"
+            "  --sizes N,N,...        process counts (default 1000,10000,50000,100000,200000)\n"
+            "  --dir DIR              where to build the synthetic proc root (default /dev/shm)\n"
+            "  --threads N            parallel collector threads (default: hardware concurrency, at least 2)\n"
+            "  --ticks N              measured ticks per size (default 5)\n"
+            "  --max-exponent X       fail if a stage grows faster than procs^X (default 1.25)\n"
+            "  --save FILE            record the results as a baseline\n"
+            "  --baseline FILE        fail if a tick is >25%% slower than in FILE\n",
+            argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+static bool parse_options(int argc, char **argv, Options &opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto need = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+        if (a == "--retain") {
+            const char *v = need();
+            if (!v) return false;
+            opt.retain_path = v;
+        } else if (a == "--retain-series") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.retain_series = (uint32_t)atoi(v);
+        } else if (a == "--retain-top") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.retain_top = (uint32_t)atoi(v);
+        } else if (a == "--record") {
+            const char *v = need();
+            if (!v) return false;
+            opt.record_path = v;
+        } else if (a == "--trace") {
+            const char *v = need();
+            if (!v) return false;
+            opt.trace_path = v;
+        } else if (a == "--arrow") {
+            const char *v = need();
+            if (!v) return false;
+            opt.arrow_path = v;
+        } else if (a == "--alert") {
+            const char *v = need();
+            if (!v) return false;
+            opt.alert_rules.push_back(v);
+        } else if (a == "--alert-rules") {
+            const char *v = need();
+            if (!v) return false;
+            opt.alert_files.push_back(v);
+        } else if (a == "--alert-out") {
+            const char *v = need();
+            if (!v) return false;
+            opt.alert_out = v;
+        } else if (a == "--arrow-batch") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.arrow_batch = (size_t)atoi(v);
+        } else if (a == "-p") {
+            const char *v = need();
+            if (!v) return false;
+            for (auto &pid : split(v, ','))
+                if (atoi(pid.c_str()) > 0) opt.watch_pids.push_back(atoi(pid.c_str()));
+            if (opt.watch_pids.empty()) return false;
+        } else if (a == "--proc-root") {
+            const char *v = need();
+            if (!v) return false;
+            opt.proc_root = v;
+        } else if (a == "--renderer") {
+            const char *v = need();
+            if (!v || (strcmp(v, "ncurses") != 0 && strcmp(v, "ansi") != 0)) return false;
+            opt.renderer = v;
+        } else if (a == "--collector-threads") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.collector_threads = (unsigned)atoi(v);
+        } else if (a == "--emergency") {
+            opt.emergency = true;
+        } else if (a == "--max-procs") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.max_procs = (size_t)atoi(v);
+        } else if (a == "--reserve-mb") {
+            const char *v = need();
+            if (!v || atoi(v) < 0) return false;
+            opt.reserve_mb = (size_t)atoi(v);
+        } else if (a == "--state") {
+            const char *v = need();
+            if (!v) return false;
+            opt.state_path = v;
+        } else if (a == "--counters") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.counters = (size_t)atoi(v);
+        } else if (a == "--state-interval") {
+            const char *v = need();
+            if (!v || atoi(v) <= 0) return false;
+            opt.state_interval = atoi(v);
+        } else if (a == "--hz") {
+            const char *v = need();
+            if (!v || atoi(v) < 1 || atoi(v) > 100) return false;
+            opt.watch_hz = atoi(v);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Accepts epoch seconds, HH:MM[:SS] (today), YYYY-MM-DDTHH:MM[:SS] or a
+// relative offset like -30m. Returns false on a malformed value.
+static bool parse_time_arg(const std::string &v, time_t now, time_t &out) {
+    if (v.empty()) return false;
+    if (v[0] == '-') {
+        char unit = v.back();
+        long n = atol(v.c_str() + 1);
+        long mult = unit == 'h' ? 3600 : unit == 'm' ? 60 : unit == 'd' ? 86400 : 1;
+        out = now - n * mult;
+        return n > 0;
+    }
+    if (v.find_first_not_of("0123456789") == std::string::npos) {
+        out = (time_t)atoll(v.c_str());
+        return true;
+    }
+    struct tm tmv;
+    localtime_r(&now, &tmv);
+    tmv.tm_sec = 0;
+    const char *rest = nullptr;
+    if (v.find('T') != std::string::npos || v.find('-') != std::string::npos)
+        rest = strptime(v.c_str(), v.find('T') != std::string::npos ? "%Y-%m-%dT%H:%M" : "%Y-%m-%d %H:%M", &tmv);
+    else
+        rest = strptime(v.c_str(), "%H:%M", &tmv);
+    if (!rest) return false;
+    if (*rest == ':') rest = strptime(rest + 1, "%S", &tmv);
+    if (!rest || *rest) return false;
+    tmv.tm_isdst = -1;
+    out = mktime(&tmv);
+    return true;
+}
+
+// Rows point into the mapped recording or retention file, which outlives
+// the query, so aggregating builds no strings.
+struct QueryRow {
+    int pid{0};
+    unsigned long long starttime{0};
+    std::string_view cmd;
+    double cpu_seconds{0.0};
+    double peak_rss_kb{0.0};
+    unsigned long long samples{0};
+    double seconds{0.0};
+};
+
+// A process, or with --per cmd a command line (proc left zero).
+struct QueryKey {
+    ProcKey proc;
+    std::string_view cmd;
+    bool operator==(const QueryKey &o) const { return proc == o.proc && cmd == o.cmd; }
+};
+
+struct QueryKeyHash {
+    size_t operator()(const QueryKey &k) const {
+        return k.cmd.empty() ? ProcKeyHash()(k.proc) : std::hash<std::string_view>()(k.cmd);
+    }
+};
+
+using QueryAgg = std::unordered_map<QueryKey, QueryRow, QueryKeyHash>;
+
+static void query_merge(QueryAgg &into, const QueryAgg &from) {
+    for (auto &kv : from) {
+        auto ins = into.emplace(kv.first, kv.second);
+        if (ins.second) continue;
+        QueryRow &r = ins.first->second;
+        r.cpu_seconds += kv.second.cpu_seconds;
+        r.peak_rss_kb = std::max(r.peak_rss_kb, kv.second.peak_rss_kb);
+        r.samples += kv.second.samples;
+        r.seconds += kv.second.seconds;
+    }
+}
+
+static void query_add(QueryAgg &agg, bool per_cmd, int pid, unsigned long long starttime, const char *cmd,
+                      double cpu_seconds, double rss_kb, double seconds, unsigned long long samples = 1) {
+    QueryRow &r = agg[per_cmd ? QueryKey{ProcKey(), cmd} : QueryKey{ProcKey{pid, starttime}, {}}];
+    if (!r.samples) {
+        r.pid = per_cmd ? 0 : pid;
+        r.starttime = per_cmd ? 0 : starttime;
+        r.cmd = cmd;
+    }
+    r.cpu_seconds += cpu_seconds;
+    r.peak_rss_kb = std::max(r.peak_rss_kb, rss_kb);
+    r.samples += samples;
+    r.seconds += seconds;
+}
+
+// Runs fn(chunk_first, chunk_last, agg) over [first, last) split into time
+// chunks, one thread per chunk, and merges the partial aggregates.
+template <typename F>
+static QueryAgg query_parallel(uint64_t first, uint64_t last, unsigned threads, F fn) {
+    QueryAgg total;
+    if (last <= first) return total;
+    uint64_t span = last - first;
+    threads = (unsigned)std::max<uint64_t>(1, std::min<uint64_t>(threads, span));
+    std::vector<QueryAgg> parts(threads);
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        uint64_t a = first + span * t / threads, b = first + span * (t + 1) / threads;
+        try {
+            pool.emplace_back([&, a, b, t]{ fn(a, b, parts[t]); });
+        } catch (const std::system_error &) {
+            fn(a, b, parts[t]);
+        }
+    }
+    for (auto &th : pool) th.join();
+    for (auto &part : parts) query_merge(total, part);
+    return total;
+}
+
+static int run_query(int argc, char **argv) {
+    if (argc < 2) return 2;
+    std::string path = argv[1];
+    time_t now = std::time(nullptr);
+    time_t from = 0, to = now;
+    size_t top = 20;
+    bool by_rss = false, per_cmd = false;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        const char *v = i + 1 < argc ? argv[++i] : nullptr;
+        if (!v) return 2;
+        if (a == "--from") { if (!parse_time_arg(v, now, from)) return 2; }
+        else if (a == "--to") { if (!parse_time_arg(v, now, to)) return 2; }
+        else if (a == "--top") top = (size_t)std::max(1, atoi(v));
+        else if (a == "--by") by_rss = std::string(v) == "rss";
+        else if (a == "--per") per_cmd = std::string(v) == "cmd";
+        else if (a == "--threads") threads = (unsigned)std::max(1, atoi(v));
+        else return 2;
+    }
+
+    QueryAgg agg;
+    RecordingReader rec;
+    RetentionStore store;
+    if (rec.open(path)) {
+        size_t first = rec.lower_bound((uint64_t)from * 1000000000ULL);
+        size_t last = rec.lower_bound((uint64_t)to * 1000000000ULL + 1);
+        long page_kb = rec.header().page_kb;
+        agg = query_parallel(first, last, threads, [&](uint64_t a, uint64_t b, QueryAgg &out) {
+            rec.scan(a, b, [&](const RecFrameHeader &fh, const RecProc *r, const char *strings) {
+                for (uint32_t i = 0; i < fh.nprocs; ++i)
+                    query_add(out, per_cmd, r[i].pid, r[i].starttime, strings + r[i].cmd_off,
+                              r[i].cpu_percent / 100.0 * fh.interval_s, (double)r[i].rss_pages * page_kb, fh.interval_s);
+            });
+        });
+    } else if (store.open(path, 0, false)) {
+        // Use the finest tier that still covers the start of the range.
+        int tier = RetentionStore::NUM_TIERS - 1;
+        for (int t = 0; t < RetentionStore::NUM_TIERS; ++t) {
+            uint64_t span = (uint64_t)RetentionStore::tier_step_s[t] * RetentionStore::tier_buckets[t];
+            if ((uint64_t)(now - from) <= span) { tier = t; break; }
+        }
+        uint32_t step = RetentionStore::tier_step_s[tier];
+        uint64_t e0 = (uint64_t)from / step, e1 = (uint64_t)to / step + 1;
+        agg = query_parallel(e0, e1, threads, [&](uint64_t a, uint64_t b, QueryAgg &out) {
+            for (uint32_t i = 0; i < store.max_series(); ++i) {
+                const RetentionStore::Series *sr = store.series(i);
+                if (sr->kind != RetentionStore::KIND_PROC) continue;
+                if (sr->last_update < a * step || sr->first_update >= b * step) continue;
+                // Buckets can be sparser than the tier step when the refresh
+                // interval is longer, so CPU-seconds are the mean of the
+                // present buckets over the time the series actually covers.
+                double cpu_sum = 0, rss_peak = 0;
+                unsigned n = 0;
+                for (uint64_t e = a; e < b; ++e) {
+                    const RetentionStore::Bucket *bk = store.find_bucket(i, tier, (uint32_t)e);
+                    if (!bk) continue;
+                    cpu_sum += bk->avg[RetentionStore::CPU];
+                    rss_peak = std::max(rss_peak, (double)bk->max[RetentionStore::RSS_KB]);
+                    n++;
+                }
+                const RetentionStore::Accum &acc = sr->acc[tier];
+                if (acc.count && acc.epoch >= a && acc.epoch < b && !store.find_bucket(i, tier, acc.epoch)) {
+                    cpu_sum += acc.sum[RetentionStore::CPU] / acc.count;
+                    rss_peak = std::max(rss_peak, (double)acc.max[RetentionStore::RSS_KB]);
+                    n++;
+                }
+                if (!n) continue;
+                double lo = std::max<double>((double)(a * step), (double)sr->first_update);
+                double hi = std::min<double>((double)(b * step), (double)sr->last_update + step);
+                double covered = std::max(0.0, hi - lo);
+                query_add(out, per_cmd, sr->pid, sr->starttime, sr->label, cpu_sum / n / 100.0 * covered, rss_peak,
+                          covered, n);
+            }
+        });
+    } else {
+        fprintf(stderr, "%s: not a recording or retention file\n", path.c_str());
+        return 1;
+    }
+
+    std::vector<QueryRow> rows;
+    rows.reserve(agg.size());
+    for (auto &kv : agg) rows.push_back(kv.second);
+    auto rank = [by_rss](const QueryRow &a, const QueryRow &b) {
+        return by_rss ? a.peak_rss_kb > b.peak_rss_kb : a.cpu_seconds > b.cpu_seconds;
+    };
+    size_t n = std::min(top, rows.size());
+    std::partial_sort(rows.begin(), rows.begin() + n, rows.end(), rank);
+
+    printf("%4s %7s %12s %12s %8s %12s %8s  %s\n", "RANK", "PID", "STARTTIME", "CPU-SEC", "AVG%", "PEAK-RSS-KB",
+           "SAMPLES", "CMD");
+    char line[256];
+    for (size_t i = 0; i < n; ++i) {
+        const QueryRow &r = rows[i];
+        char *p = put_int(line, (long long)i + 1, 4);
+        *p++ = ' ';
+        p = put_int(p, r.pid, 7);
+        *p++ = ' ';
+        p = put_int(p, (long long)r.starttime, 12);
+        *p++ = ' ';
+        p = put_fixed(p, r.cpu_seconds, 2, 12);
+        *p++ = ' ';
+        p = put_fixed(p, r.seconds > 0 ? r.cpu_seconds / r.seconds * 100.0 : 0.0, 2, 8);
+        *p++ = ' ';
+        p = put_fixed(p, r.peak_rss_kb, 0, 12);
+        *p++ = ' ';
+        p = put_int(p, (long long)r.samples, 8);
+        p = stpcpy(p, "  ");
+        size_t cmd = std::min<size_t>(r.cmd.size(), 60);
+        memcpy(p, r.cmd.data(), cmd);
+        p += cmd;
+        *p++ = '\n';
+        fwrite(line, 1, p - line, stdout);
+    }
+    return 0;
+}
+
+// Synthetic /proc for the scaling benchmark: system files plus pid
+// directories with stat, cmdline, cgroup and io in the kernel's formats.
+class SyntheticProc {
+public:
+    explicit SyntheticProc(const std::string &root) : root_(root) {}
+
+    bool init() {
+        if (mkdir(root_.c_str(), 0755) < 0 && errno != EEXIST) return false;
+        return put("meminfo", "MemTotal:       16384000 kB\nMemFree:         8192000 kB\nMemAvailable:   12288000 kB\n") &&
+               put("cpuinfo", "processor\t: 0\n") && advance_clock(0);
+    }
+
+    // Adds pids up to n.
+    bool grow(size_t n) {
+        for (size_t pid = count_ + 1; pid <= n; ++pid) {
+            std::string dir = root_ + "/" + std::to_string(pid);
+            if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) return false;
+            std::string cmdline = "/usr/bin/worker" + std::to_string(pid % 97) + '\0' + "--id" + '\0' + std::to_string(pid);
+            if (!put(dir + "/cmdline", cmdline) ||
+                !put(dir + "/cgroup", "0::/bench.slice/group" + std::to_string(pid % 50) + ".scope\n") ||
+                !put(dir + "/io", "rchar: 0\nwchar: 0\nsyscr: 0\nsyscw: 0\nread_bytes: " + std::to_string(pid * 4096) +
+                                  "\nwrite_bytes: 0\ncancelled_write_bytes: 0\n") ||
+                !write_stat(pid, 0))
+                return false;
+        }
+        count_ = std::max(count_, n);
+        return true;
+    }
+
+    // One interval of activity: the system clock moves on by 100 jiffies and
+    // a rotating 5% of processes accumulate CPU time.
+    bool tick() {
+        ++ticks_;
+        size_t busy = std::max<size_t>(1, count_ / 20);
+        for (size_t i = 0; i < busy; ++i)
+            if (!write_stat(1 + (cursor_ + i) % count_, ticks_)) return false;
+        cursor_ = (cursor_ + busy) % count_;
+        return advance_clock(ticks_);
+    }
+
+    const std::string &root() const { return root_; }
+
+    static int remove_entry(const char *path, const struct stat *, int, struct FTW *) { return ::remove(path); }
+    void destroy() { nftw(root_.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS); }
+
+private:
+    bool put(const std::string &path, const std::string &data) {
+        std::string full = path[0] == '/' ? path : root_ + "/" + path;
+        int fd = open(full.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+        close(fd);
+        return ok;
+    }
+
+    bool write_stat(size_t pid, unsigned long t) {
+        char buf[512];
+        unsigned long utime = t * 20 + pid % 13;
+        int len = snprintf(buf, sizeof(buf),
+                           "%zu (worker%zu) S 1 %zu %zu 0 -1 4194560 %lu 0 %zu 0 %lu %lu 0 0 20 0 1 0 %zu "
+                           "%lu %zu 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+                           pid, pid % 97, pid, pid, 1000 + t * 50, pid % 7, utime, utime / 4, 1000 + pid,
+                           (unsigned long)(64 << 20) + pid * 4096, 256 + pid % 4096);
+        return put(root_ + "/" + std::to_string(pid) + "/stat", std::string(buf, len));
+    }
+
+    bool advance_clock(unsigned long t) {
+        unsigned long long user = 100000 + t * 60, idle = 500000 + t * 40;
+        return put("stat", "cpu  " + std::to_string(user) + " 0 0 " + std::to_string(idle) + " 0 0 0 0 0 0\n");
+    }
+
+    std::string root_;
+    size_t count_{0};
+    size_t cursor_{0};
+    unsigned long ticks_{0};
+};
+
+static double cpu_seconds() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+struct BenchResult {
+    std::string collector;
+    size_t procs{0};
+    double collect_ms{0}, compute_ms{0}, sort_ms[NUM_SORT_KEYS]{};
+    double cpu_ms{0};   // process CPU time spent per tick, all threads
+    long rss_kb{0};
+    size_t no_slot{0};  // most processes in one tick that the table had no slot for
+    double tick_ms() const { return collect_ms + compute_ms + sort_ms[SORT_CPU]; }
+};
+
+// Least-squares slope of log(y) against log(x): 1 for linear scaling.
+// Timings under a millisecond are mostly cache and timer noise and are left
+// out of the fit.
+static double scaling_exponent(const std::vector<double> &x, const std::vector<double> &y) {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < x.size(); ++i) {
+        if (x[i] <= 0 || y[i] < 1.0) continue;
+        double lx = std::log(x[i]), ly = std::log(y[i]);
+        n += 1; sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly;
+    }
+    double d = n * sxx - sx * sx;
+    return n >= 2 && d > 0 ? (n * sxy - sx * sy) / d : 1.0;
+}
+
+static double median(std::vector<double> v) {
+    if (v.empty()) return 0;
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+// Builds a synthetic proc root of growing size and times what one tick of
+// the main loop does with it: the scan, slot assignment and rate
+// computation, and each sort mode. The serial collector is the existing
+// read_all_procs/std::map/std::sort path, i.e. the baseline. Fails if any
+// stage scales worse than --max-exponent, or, with --baseline, if a tick got
+// more than 25% slower than the recorded run.
+static int run_bench_scale(int argc, char **argv) {
+    std::vector<size_t> sizes = {1000, 10000, 50000, 100000, 200000};
+    std::string dir = "/dev/shm/sysmon-bench-" + std::to_string(getpid());
+    std::string save_path, baseline_path;
+    unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    int ticks = 5;
+    double max_exponent = 1.25;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        const char *v = i + 1 < argc ? argv[++i] : nullptr;
+        if (!v) return 2;
+        if (a == "--sizes") {
+            sizes.clear();
+            for (auto &n : split(v, ','))
+                if (atol(n.c_str()) > 0) sizes.push_back((size_t)atol(n.c_str()));
+            std::sort(sizes.begin(), sizes.end());
+        }
+        else if (a == "--dir") dir = v;
+        else if (a == "--threads") threads = (unsigned)std::max(2, atoi(v));
+        else if (a == "--ticks") ticks = std::max(1, atoi(v));
+        else if (a == "--max-exponent") max_exponent = atof(v);
+        else if (a == "--save") save_path = v;
+        else if (a == "--baseline") baseline_path = v;
+        else return 2;
+    }
+    if (sizes.empty()) return 2;
+
+    SyntheticProc synth(dir);
+    if (!synth.init()) {
+        fprintf(stderr, "cannot create %s\n", dir.c_str());
+        return 1;
+    }
+    g_proc_root = dir;
+    const std::string collectors[2] = {"serial", "parallel" + std::to_string(threads)};
+    std::vector<BenchResult> results;
+    const long rss_start = self_status_kb("VmRSS:");
+
+    printf("%-11s %7s %10s %10s %10s", "collector", "procs", "tick ms", "collect", "compute");
+    for (int k = 0; k < NUM_SORT_KEYS; ++k) printf(" %8s", (std::string("sort ") + sort_key_names[k]).c_str());
+    printf(" %8s %9s %7s %7s\n", "cpu ms", "RSS KB", "B/proc", "no slot");
+    for (size_t n : sizes) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (!synth.grow(n)) {
+            // Five inodes per process; a small tmpfs runs out first (use --dir).
+            fprintf(stderr, "cannot populate %s with %zu processes: %s\n", dir.c_str(), n, strerror(errno));
+            synth.destroy();
+            return 1;
+        }
+        fprintf(stderr, "built %zu processes in %.1f s\n", n,
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+        for (int c = 0; c < 2; ++c) {
+            unsigned nthreads = c == 0 ? 1 : threads;
+            BenchResult r;
+            r.collector = collectors[c];
+            r.procs = n;
+            {
+                ProcTable table;  // sized as in the monitor, so slot exhaustion shows up
+                SystemSnapshot prev_snap = read_system_snapshot();
+                ProcMap prev = read_all_procs(ScanBudget(), nullptr, nthreads);  // warm the cmdline cache
+                for (auto &kv : prev) table.assign(kv.second, 0);
+                std::vector<double> collect, compute, cpu, sorts[NUM_SORT_KEYS];
+                for (int t = 1; t <= ticks; ++t) {
+                    synth.tick();
+                    double c0 = cpu_seconds();
+                    auto a = std::chrono::steady_clock::now();
+                    SystemSnapshot snap = read_system_snapshot();
+                    ProcMap cur = read_all_procs(ScanBudget(), nullptr, nthreads);
+                    auto b = std::chrono::steady_clock::now();
+                    size_t no_slot = 0;
+                    for (auto &kv : cur) {
+                        table.assign(kv.second, t);
+                        no_slot += kv.second.slot == NO_SLOT;
+                    }
+                    r.no_slot = std::max(r.no_slot, no_slot);
+                    table.sweep(t);
+                    compute_cpu_mem_percent(cur, prev, snap, prev_snap);
+                    std::vector<ProcInfo> plist;
+                    plist.reserve(cur.size());
+                    for (auto &kv : cur) plist.push_back(kv.second);
+                    auto e = std::chrono::steady_clock::now();
+                    collect.push_back(std::chrono::duration<double, std::milli>(b - a).count());
+                    compute.push_back(std::chrono::duration<double, std::milli>(e - b).count());
+                    cpu.push_back((cpu_seconds() - c0) * 1000);
+                    for (int k = 0; k < NUM_SORT_KEYS; ++k) {
+                        std::vector<ProcInfo> copy = plist;
+                        auto s0 = std::chrono::steady_clock::now();
+                        sort_processes(copy, (SortKey)k);
+                        sorts[k].push_back(
+                            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s0).count());
+                    }
+                    r.rss_kb = std::max(r.rss_kb, self_status_kb("VmRSS:"));
+                    prev = std::move(cur);
+                    prev_snap = snap;
+                }
+                r.collect_ms = median(collect);
+                r.compute_ms = median(compute);
+                r.cpu_ms = median(cpu);
+                for (int k = 0; k < NUM_SORT_KEYS; ++k) r.sort_ms[k] = median(sorts[k]);
+            }
+            printf("%-11s %7zu %10.1f %10.1f %10.1f", r.collector.c_str(), n, r.tick_ms(), r.collect_ms, r.compute_ms);
+            for (int k = 0; k < NUM_SORT_KEYS; ++k) printf(" %8.1f", r.sort_ms[k]);
+            printf(" %8.1f %9ld %7ld %7zu%s\n", r.cpu_ms, r.rss_kb, (r.rss_kb - rss_start) * 1024 / (long)n,
+                   r.no_slot, r.tick_ms() > 1000 ? "  over 1 s tick" : "");
+            fflush(stdout);
+            results.push_back(r);
+        }
+    }
+    synth.destroy();
+
+    bool ok = true;
+    printf("\nscaling exponents (1.0 = linear, limit %.2f):\n", max_exponent);
+    for (auto &name : collectors) {
+        std::vector<double> x, tick, collect, compute, sort_worst;
+        for (auto &r : results) {
+            if (r.collector != name) continue;
+            x.push_back((double)r.procs);
+            tick.push_back(r.tick_ms());
+            collect.push_back(r.collect_ms);
+            compute.push_back(r.compute_ms);
+            sort_worst.push_back(*std::max_element(r.sort_ms, r.sort_ms + NUM_SORT_KEYS));
+        }
+        const char *stage[4] = {"tick", "collect", "compute", "sort"};
+        const std::vector<double> *ys[4] = {&tick, &collect, &compute, &sort_worst};
+        printf("  %-11s", name.c_str());
+        for (int i = 0; i < 4; ++i) {
+            double e = scaling_exponent(x, *ys[i]);
+            bool bad = e > max_exponent;
+            ok = ok && !bad;
+            printf(" %s %.2f%s", stage[i], e, bad ? " SUPER-LINEAR" : "");
+        }
+        printf("\n");
+    }
+
+    if (!baseline_path.empty()) {
+        std::ifstream f(baseline_path);
+        std::string line, name;
+        size_t n;
+        double tick;
+        printf("\nagainst baseline %s:\n", baseline_path.c_str());
+        while (std::getline(f, line)) {
+            std::istringstream ls(line);
+            if (line.empty() || line[0] == '#' || !(ls >> name >> n >> tick)) continue;
+            for (auto &r : results) {
+                if (r.collector != name || r.procs != n) continue;
+                double ratio = tick > 0 ? r.tick_ms() / tick : 1.0;
+                bool bad = ratio > 1.25;
+                ok = ok && !bad;
+                printf("  %-11s %7zu %8.1f -> %8.1f ms (%.2fx)%s\n", name.c_str(), n, tick, r.tick_ms(), ratio,
+                       bad ? " REGRESSION" : "");
+            }
+        }
+    }
+    if (!save_path.empty()) {
+        FILE *out = fopen(save_path.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", save_path.c_str());
+            return 1;
+        }
+        fprintf(out, "# collector procs tick_ms collect_ms compute_ms");
+        for (int k = 0; k < NUM_SORT_KEYS; ++k) fprintf(out, " sort_%s_ms", sort_key_names[k]);
+        fprintf(out, " cpu_ms rss_kb\n");
+        for (auto &r : results) {
+            fprintf(out, "%s %zu %.3f %.3f %.3f", r.collector.c_str(), r.procs, r.tick_ms(), r.collect_ms, r.compute_ms);
+            for (int k = 0; k < NUM_SORT_KEYS; ++k) fprintf(out, " %.3f", r.sort_ms[k]);
+            fprintf(out, " %.3f %ld\n", r.cpu_ms, r.rss_kb);
+        }
+        fclose(out);
+    }
+    printf("\n%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static double process_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Replays the same sequence of process-list frames through each renderer,
+// writing to a scratch file instead of a terminal, and reports bytes and CPU
+// per frame. Each frame re-sorts a list in which a tenth of the processes
+// changed, which is what a normal tick looks like.
+static int run_bench_render(int argc, char **argv) {
+    size_t nprocs = 2000;
+    int nframes = 300, rows = 50, cols = 200;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        const char *v = i + 1 < argc ? argv[++i] : nullptr;
+        if (!v) return 2;
+        if (a == "--procs") nprocs = (size_t)std::max(1, atoi(v));
+        else if (a == "--frames") nframes = std::max(2, atoi(v));
+        else if (a == "--rows") rows = std::max(10, atoi(v));
+        else if (a == "--cols") cols = std::max(40, atoi(v));
+        else return 2;
+    }
+
+    ProcTable table(nprocs);
+    MetricHistory hist;
+    ProcMap procs;
+    for (size_t i = 0; i < nprocs; ++i) {
+        ProcInfo p;
+        p.pid = 1000 + (int)i;
+        p.starttime = i;
+        p.cmd = "/usr/bin/worker" + std::to_string(i % 97) + " --id " + std::to_string(i);
+        p.rss = 1000 + (long)(i * 37 % 50000);
+        auto &q = procs[p.key()] = p;
+        table.assign(q, 0);
+        hist.reset(q.slot);
+    }
+    SystemSnapshot snap;
+    snap.num_cpus = 8;
+    CpuAccounting acct;
+    AlertEngine alerts;
+    uint32_t rng = 12345;
+    auto rnd = [&]() { return rng = rng * 1664525u + 1013904223u; };
+
+    std::vector<Frame> frames(nframes);
+    ProcLayout layout;
+    layout.fit(cols);
+    double compose_us = process_cpu_us();
+    for (int t = 0; t < nframes; ++t) {
+        for (auto &kv : procs) {
+            ProcInfo &p = kv.second;
+            if (rnd() % 10 == 0) {
+                p.cpu_percent = (rnd() % 10000) / 100.0;
+                p.mem_percent = p.rss * 4.0 / 16384000.0 * 100.0;
+                p.cpu_avg[0] = p.cpu_percent;
+                p.cpu_avg[1] = (p.cpu_avg[1] * 9 + p.cpu_percent) / 10;
+                p.cpu_avg[2] = (p.cpu_avg[2] * 59 + p.cpu_percent) / 60;
+            }
+            float vals[MetricHistory::NUM_METRICS] = {(float)p.cpu_percent, (float)p.rss * 4, 0, 0};
+            hist.push(p.slot, vals);
+        }
+        std::vector<ProcInfo> plist;
+        plist.reserve(procs.size());
+        for (auto &kv : procs) plist.push_back(kv.second);
+        sort_processes(plist, SORT_CPU);
+        Frame &f = frames[t];
+        f.resize(rows, cols);
+        Canvas header(f, Rect{0, 0, 3, cols}), list(f, Rect{3, 0, rows - 3, cols});
+        draw_header(header, layout, snap, acct, SORT_CPU, alerts, "");
+        draw_processes(list, layout, plist, 0, rows - 3, hist, -1);
+    }
+    compose_us = (process_cpu_us() - compose_us) / nframes;
+
+    printf("%d frames of %dx%d, %zu processes; composing a frame: %.0f us CPU\n", nframes, rows, cols, nprocs,
+           compose_us);
+    printf("%-9s %12s %14s %14s\n", "renderer", "first frame", "bytes/frame", "CPU us/frame");
+    setenv("LINES", std::to_string(rows).c_str(), 1);
+    setenv("COLUMNS", std::to_string(cols).c_str(), 1);
+    for (int b = 0; b < 2; ++b) {
+        FILE *out = tmpfile();
+        FILE *in = fopen("/dev/null", "r");
+        if (!out || !in) return 1;
+        std::unique_ptr<Renderer> r;
+        if (b == 0) r.reset(new NcursesRenderer(out, in));
+        else r.reset(new AnsiRenderer(fileno(out), fileno(in)));
+        if (!r->start()) {
+            fprintf(stderr, "cannot start %s\n", r->name());
+            return 1;
+        }
+        auto position = [&]() {
+            fflush(out);
+            return (long long)lseek(fileno(out), 0, SEEK_CUR);
+        };
+        long long base = position();
+        r->present(frames[0]);
+        long long first = position() - base;
+        double cpu = process_cpu_us();
+        for (int t = 1; t < nframes; ++t) r->present(frames[t]);
+        cpu = (process_cpu_us() - cpu) / (nframes - 1);
+        long long steady = (position() - base - first) / (nframes - 1);
+        r->stop();
+        printf("%-9s %12lld %14lld %14.0f\n", r->name(), first, steady, cpu);
+        fclose(out);
+        fclose(in);
+    }
+    return 0;
+}
+
+// Formats the numeric part of a process row for synthetic processes with
+// snprintf and with put_int/put_fixed, checks that both agree and reports
+// the cost of each.
+static int run_bench_format(int argc, char **argv) {
+    size_t nrows = 200000;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        const char *v = i + 1 < argc ? argv[++i] : nullptr;
+        if (!v) return 2;
+        if (a == "--rows") nrows = (size_t)std::max(1, atoi(v));
+        else return 2;
+    }
+
+    std::vector<ProcInfo> procs(nrows);
+    uint32_t rng = 12345;
+    auto rnd = [&]() { return rng = rng * 1664525u + 1013904223u; };
+    for (size_t i = 0; i < nrows; ++i) {
+        ProcInfo &p = procs[i];
+        p.pid = 1 + (int)(rnd() % 4194304);
+        p.cpu_percent = (rnd() % 1000000) / 997.0;
+        p.child_cpu_percent = (rnd() % 1000) / 7.0;
+        p.mem_percent = (rnd() % 100000) / 1009.0;
+        p.rss = rnd() % 10000000;
+        for (double &a : p.cpu_avg) a = (rnd() % 1000000) / 9973.0;
+        p.anomaly = (rnd() % 1000) / 13.0f;
+    }
+
+    std::vector<std::string> with_printf(nrows), with_put(nrows);
+    char buf[256];
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nrows; ++i) {
+        const ProcInfo &p = procs[i];
+        int n = snprintf(buf, sizeof(buf), "%7d %7.2f %7.2f %8.2f %10ld %7.2f %7.2f %7.2f %5.1f", p.pid,
+                         p.cpu_percent, p.child_cpu_percent, p.mem_percent, p.rss, p.cpu_avg[0], p.cpu_avg[1],
+                         p.cpu_avg[2], p.anomaly);
+        with_printf[i].assign(buf, n);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nrows; ++i) {
+        const ProcInfo &p = procs[i];
+        char *o = put_int(buf, p.pid, 7);
+        *o++ = ' ';
+        o = put_fixed(o, p.cpu_percent, 2, 7);
+        *o++ = ' ';
+        o = put_fixed(o, p.child_cpu_percent, 2, 7);
+        *o++ = ' ';
+        o = put_fixed(o, p.mem_percent, 2, 8);
+        *o++ = ' ';
+        o = put_int(o, p.rss, 10);
+        for (double a : p.cpu_avg) {
+            *o++ = ' ';
+            o = put_fixed(o, a, 2, 7);
+        }
+        *o++ = ' ';
+        o = put_fixed(o, p.anomaly, 1, 5);
+        with_put[i].assign(buf, o - buf);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    size_t differ = 0;
+    for (size_t i = 0; i < nrows; ++i)
+        if (with_printf[i] != with_put[i] && differ++ < 3)
+            fprintf(stderr, "differs: \"%s\" vs \"%s\"\n", with_printf[i].c_str(), with_put[i].c_str());
+    double printf_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / nrows;
+    double put_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / nrows;
+    printf("%zu rows of 9 numbers\n", nrows);
+    printf("%-10s %10.0f ns/row\n", "snprintf", printf_ns);
+    printf("%-10s %10.0f ns/row (%.1fx)\n", "put_*", put_ns, put_ns > 0 ? printf_ns / put_ns : 0.0);
+    if (differ) printf("%zu row(s) differ (printf rounds exact ties to even)\n", differ);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "bench-format") {
+        int rc = run_bench_format(argc - 1, argv + 1);
+        if (rc == 2) usage(argv[0]);
+        return rc;
+    }
+    if (argc > 1 && std::string(argv[1]) == "bench-render") {
+        int rc = run_bench_render(argc - 1, argv + 1);
+        if (rc == 2) usage(argv[0]);
+        return rc;
+    }
+    if (argc > 1 && std::string(argv[1]) == "bench-scale") {
+        int rc = run_bench_scale(argc - 1, argv + 1);
+        if (rc == 2) usage(argv[0]);
+        return rc;
+    }
+    if (argc > 1 && std::string(argv[1]) == "query") {
+        int rc = run_query(argc - 1, argv + 1);
+        if (rc == 2) usage(argv[0]);
+        return rc;
+    }
+    if (argc > 1 && std::string(argv[1]) == "export-trace") {
+        int rc = run_export_trace(argc - 1, argv + 1);
+        if (rc == 2) usage(argv[0]);
+        return rc;
+    }
+
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!opt.proc_root.empty()) g_proc_root = opt.proc_root;
+
+    EmergencyState emergency;
+    if (opt.emergency) emergency = enter_emergency_mode(opt.reserve_mb);
+    const size_t max_procs = opt.max_procs ? opt.max_procs : opt.emergency ? 4096 : SIZE_MAX;
+
+    if (!opt.watch_pids.empty()) {
+        signal(SIGINT, on_quit_signal);
+        signal(SIGTERM, on_quit_signal);
+        auto screen = make_renderer(opt.renderer);
+        if (!screen->start()) return 1;
+        bool ok = run_watch(*screen, opt.watch_pids, opt.watch_hz);
+        screen->stop();
+        if (!ok) fprintf(stderr, "none of the watched pids exist\n");
+        return ok ? 0 : 1;
+    }
+
+    RetentionStore retention;
+    if (!opt.retain_path.empty() && !retention.open(opt.retain_path, opt.retain_series)) {
+        fprintf(stderr, "cannot open retention file %s (%zu bytes for %u series)\n", opt.retain_path.c_str(),
+                RetentionStore::file_bytes(opt.retain_series), opt.retain_series);
+        return 1;
+    }
+
+    Recorder recorder;
+    if (!opt.record_path.empty() && !recorder.open(opt.record_path, read_system_snapshot())) {
+        fprintf(stderr, "cannot open recording %s\n", opt.record_path.c_str());
+        return 1;
+    }
+
+    TraceExporter tracer;
+    if (!opt.trace_path.empty() && !tracer.open(opt.trace_path)) {
+        fprintf(stderr, "cannot open trace %s\n", opt.trace_path.c_str());
+        return 1;
+    }
+
+    ArrowWriter arrow;
+    if (!opt.arrow_path.empty() && !arrow.open(opt.arrow_path, opt.arrow_batch)) {
+        fprintf(stderr, "cannot open %s\n", opt.arrow_path.c_str());
+        return 1;
+    }
+
+    AlertEngine alerts;
+    std::string alert_err;
+    for (auto &f : opt.alert_files)
+        if (!alerts.add_rules_file(f, alert_err)) {
+            fprintf(stderr, "%s: %s\n", f.c_str(), alert_err.c_str());
+            return 1;
+        }
+    for (auto &r : opt.alert_rules)
+        if (!alerts.add_rule(r, alert_err)) {
+            fprintf(stderr, "alert \"%s\": %s\n", r.c_str(), alert_err.c_str());
+            return 1;
+        }
+    if (!opt.alert_out.empty() && !alerts.set_output(opt.alert_out)) {
+        fprintf(stderr, "cannot open alert output %s\n", opt.alert_out.c_str());
+        return 1;
+    }
+
+    signal(SIGINT, on_quit_signal);
+    signal(SIGTERM, on_quit_signal);
+
+    auto screen = make_renderer(opt.renderer);
+    if (!screen->start()) {
+        fprintf(stderr, "cannot start the %s renderer\n", opt.renderer.c_str());
+        return 1;
+    }
+
+    int rows, cols;
+    screen->size(rows, cols);
+
+    const int event_rows = 8;
+    const int detail_rows = 12;
+    const int leak_rows = 8;
+    const int numa_rows = 10;
+    const int placement_rows = 12;
+    const int throttle_rows = 10;
+    bool show_events = false;
+    bool show_detail = false;
+    bool show_leaks = false;
+    bool show_numa = false;
+    bool show_placement = false;
+    bool show_throttle = false;
+    Frame frame;
+    ProcLayout layout;
+    Rect header_r, proc_r, event_r, detail_r, leak_r, numa_r, placement_r, throttle_r;
+    int proc_rows = 0;
+
+    PerfCounters perf(opt.counters);
+    unsigned extra_cols = 0;  // optional process list columns with data
+
+    // Recomputes the pane rectangles; the column layout is only redone when
+    // the width or the column set changed.
+    auto relayout = [&]() {
+        frame.resize(rows, cols);
+        layout.fit(cols, extra_cols);
+        header_r = Rect{0, 0, 3, cols};
+        int bottom = rows;
+        if (show_events) {
+            bottom -= event_rows;
+            event_r = Rect{bottom, 0, event_rows, cols};
+        }
+        if (show_leaks) {
+            bottom -= leak_rows;
+            leak_r = Rect{bottom, 0, leak_rows, cols};
+        }
+        if (show_numa) {
+            bottom -= numa_rows;
+            numa_r = Rect{bottom, 0, numa_rows, cols};
+        }
+        if (show_placement) {
+            bottom -= placement_rows;
+            placement_r = Rect{bottom, 0, placement_rows, cols};
+        }
+        if (show_throttle) {
+            bottom -= throttle_rows;
+            throttle_r = Rect{bottom, 0, throttle_rows, cols};
+        }
+        if (show_detail) {
+            bottom -= detail_rows;
+            detail_r = Rect{bottom, 0, detail_rows, cols};
+        }
+        proc_rows = std::max(1, bottom - 3);
+        proc_r = Rect{3, 0, proc_rows, cols};
+    };
+    relayout();
+
+    SystemSnapshot prev_snap = read_system_snapshot();
+    ProcTable table;
+    MetricHistory history;
+    CpuEwma ewma;
+    SlotMetrics slot_metrics;
+    LeakDetector leaks;
+    AnomalyDetector anomalies;
+    NumaMonitor numa;
+    // The NUMA, placement and throttling panes only sample while shown, plus
+    // a warm-up sample when toggled on. That one falls between ticks, so each
+    // pane measures its own interval.
+    auto since = [](std::chrono::steady_clock::time_point &last) {
+        auto now = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(now - last).count();
+        last = now;
+        return s;
+    };
+    std::chrono::steady_clock::time_point numa_at, placement_at, throttle_at;
+    CpuPlacement placement;
+    CgroupThrottle throttle;
+    auto start_time = std::chrono::steady_clock::now();
+    unsigned long long tick = 0;
+    ScanStats scan;
+    size_t scan_cap = max_procs;
+    auto prev_procs = read_all_procs(ScanBudget{scan_cap, nullptr}, &scan, opt.collector_threads);
+    for (auto &kv : prev_procs)
+        if (table.assign(kv.second, tick)) {
+            history.reset(kv.second.slot);
+            ewma.reset(kv.second.slot);
+        }
+    ProcInfo detail_proc;
+
+    int refresh_interval = 2;
+    SortKey sort_key = SORT_CPU;
+    ListCursor cursor;
+    bool quit = false;
+    bool goto_active = false;
+    std::string goto_pid, prompt;
+
+    EventLog events;
+    size_t event_scroll = 0;
+    ProcEventRing scan_events;
+    ProcConnector connector;
+    bool connector_ok = connector.start((unsigned long long)refresh_interval * 1000000000ULL);
+
+    // A checkpoint from a run that ended moments ago stands in for the
+    // startup scan as the previous tick, so the first rates cover the gap
+    // instead of a few milliseconds. Beyond a few minutes they would average
+    // over too long to mean much.
+    const uint64_t state_max_age_s = 300;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    if (!opt.state_path.empty()) {
+        ProcMap restored;
+        std::string why;
+        if (StateCheckpoint::load(opt.state_path, prev_procs, state_max_age_s, prev_snap, restored, table, history,
+                                  ewma, why)) {
+            events.push("resumed " + std::to_string(restored.size()) + " processes from " + opt.state_path);
+            prev_procs.swap(restored);
+        } else {
+            events.push("not resuming: " + why);
+        }
+    }
+
+    while (!g_quit) {
+        SystemSnapshot cur_snap = read_system_snapshot();
+        auto cur_procs = read_all_procs(ScanBudget{scan_cap, &prev_procs}, &scan, opt.collector_threads);
+        // Back off while /proc is failing for lack of memory; recover once reads succeed.
+        if (scan.failed) scan_cap = std::max<size_t>(256, std::min(scan_cap, scan.listed) / 2);
+        else if (scan_cap < max_procs) scan_cap = scan_cap > max_procs / 2 ? max_procs : scan_cap * 2;
+        ++tick;
+        for (auto &kv : cur_procs)
+            if (table.assign(kv.second, tick)) {
+                history.reset(kv.second.slot);
+                ewma.reset(kv.second.slot);
+                slot_metrics.reset(kv.second.slot);
+                alerts.reset(kv.second.slot);
+                leaks.reset(kv.second.slot);
+                anomalies.reset(kv.second.slot);
+            }
+        table.sweep(tick);
+        compute_cpu_mem_percent(cur_procs, prev_procs, cur_snap, prev_snap);
+        detect_proc_events(cur_procs, prev_procs, scan_events);
+        static long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+        double dt_s = snapshot_interval_s(cur_snap, prev_snap);
+        if (opt.counters) {
+            perf.update(cur_procs, dt_s, tick);
+            extra_cols = (perf.hardware() ? 1u << ProcLayout::IPC | 1u << ProcLayout::MPKI
+                                          : perf.task_clock() ? 1u << ProcLayout::ONCPU : 0) |
+                         (perf.switches() ? 1u << ProcLayout::CSW : 0);
+            layout.fit(cols, extra_cols);
+        }
+        for (auto &kv : cur_procs) {
+            ProcInfo &p = kv.second;
+            if (p.slot == NO_SLOT) continue;
+            ewma.update(p.slot, p.cpu_percent, dt_s, p.cpu_avg);
+            float vals[MetricHistory::NUM_METRICS] = {
+                (float)p.cpu_percent, (float)(p.rss * page_size_kb), (float)p.io_kb_per_s, (float)p.faults_per_s};
+            history.push(p.slot, vals);
+        }
+        slot_metrics.update(cur_procs, table.capacity(), dt_s);
+        if (!alerts.empty()) alerts.evaluate(slot_metrics, table, (float)dt_s, events);
+        anomalies.update(slot_metrics, dt_s);
+        for (auto &kv : cur_procs) {
+            kv.second.anomaly = anomalies.score(kv.second.slot);
+            kv.second.anomaly_metric = anomalies.metric(kv.second.slot);
+        }
+        leaks.update(slot_metrics, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count(), dt_s);
+        CpuAccounting acct = account_cpu(cur_procs, prev_procs, cur_snap, prev_snap);
+        if (show_numa) numa.update(cur_procs, since(numa_at), tick);
+        if (show_placement) placement.update(cur_procs, since(placement_at));
+        if (show_throttle) throttle.update(since(throttle_at), tick);
+
+        if (retention.is_open()) feed_retention(retention, cur_procs, opt.retain_top, (uint64_t)std::time(nullptr));
+        uint64_t now_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (recorder.is_open()) recorder.write_frame(now_ns, dt_s, cur_snap, cur_procs);
+        if (tracer.is_open()) tracer.frame(now_ns, trace_samples(cur_procs));
+        if (arrow.is_open()) arrow.append(now_ns, cur_procs);
+
+        std::vector<ProcInfo> plist;
+        plist.reserve(cur_procs.size());
+        for (auto &kv : cur_procs) plist.push_back(kv.second);
+
+        sort_processes(plist, sort_key);
+        cursor.follow(plist);
+
+        if (show_detail) {
+            auto it = cur_procs.find(detail_proc.key());
+            if (it != cur_procs.end()) detail_proc = it->second;
+        }
+
+        size_t drained = events.drain(connector.events()) + events.drain(scan_events);
+        if (event_scroll) event_scroll = std::min(event_scroll + drained, events.size());  // keep the view anchored
+
+        prev_snap = cur_snap;
+        prev_procs = cur_procs;
+        if (!opt.state_path.empty() &&
+            std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::seconds(opt.state_interval)) {
+            StateCheckpoint::save(opt.state_path, prev_snap, prev_procs, history);
+            last_checkpoint = std::chrono::steady_clock::now();
+        }
+
+        // Until the next tick only keys are handled. Each one redraws from this
+        // tick's data, which touches just the visible rows, so navigation does
+        // not wait for sampling.
+        auto next_tick = std::chrono::steady_clock::now() + std::chrono::seconds(refresh_interval);
+        bool redraw = true;
+        while (!g_quit) {
+            if (redraw) {
+                frame.clear();
+                Canvas header(frame, header_r), procwin(frame, proc_r);
+                std::string note = scan_note(emergency, scan, scan_cap), link = screen->status();
+                if (!link.empty()) note += (note.empty() ? "" : " | ") + link;
+                std::string perf_error = opt.counters ? perf.error() : std::string();
+                if (!perf_error.empty()) note += (note.empty() ? "" : " | ") + perf_error;
+                if (goto_active) prompt = "goto pid: " + goto_pid + "_";
+                if (!prompt.empty()) note += (note.empty() ? "" : " | ") + prompt;
+                draw_header(header, layout, cur_snap, acct, sort_key, alerts, note);
+                cursor.keep_visible(proc_rows, (int)plist.size());
+                draw_processes(procwin, layout, plist, cursor.top, proc_rows, history, cursor.sel);
+                if (show_detail) {
+                    Canvas detailwin(frame, detail_r);
+                    draw_detail(detailwin, detail_proc, history, table);
+                }
+                if (show_leaks) {
+                    Canvas leakwin(frame, leak_r);
+                    draw_leaks(leakwin, leaks, slot_metrics, table, cur_snap);
+                }
+                if (show_numa) {
+                    Canvas numawin(frame, numa_r);
+                    draw_numa(numawin, numa);
+                }
+                if (show_placement) {
+                    Canvas placementwin(frame, placement_r);
+                    draw_cpu_placement(placementwin, placement);
+                }
+                if (show_throttle) {
+                    Canvas throttlewin(frame, throttle_r);
+                    draw_throttle(throttlewin, throttle);
+                }
+                if (show_events) {
+                    Canvas eventwin(frame, event_r);
+                    draw_events(eventwin, events, connector_ok, event_rows, event_scroll,
+                                connector.events().dropped() + scan_events.dropped());
+                }
+                // Sampling keeps its pace; a slow terminal only delays the repaints.
+                screen->present(frame);
+                redraw = false;
+            }
+
+            int ch = screen->key();
+            if (ch == ERR) {
+                if (!screen->idle(next_tick)) break;
+                continue;
+            }
+            redraw = true;
+            prompt.clear();
+            int moved = -1;
+            if (ch == KEY_RESIZE) {
+                screen->size(rows, cols);
+                relayout();
+            }
+            else if (goto_active) {
+                if (isdigit(ch) && goto_pid.size() < 9) goto_pid += (char)ch;
+                else if ((ch == KEY_BACKSPACE || ch == 8) && !goto_pid.empty()) goto_pid.pop_back();
+                else if (ch == 27) goto_active = false;
+                else if (ch == '\n' || ch == '\r' || ch == KEY_ENTER) {
+                    goto_active = false;
+                    int pid = atoi(goto_pid.c_str());
+                    auto it = std::find_if(plist.begin(), plist.end(), [&](const ProcInfo &p) { return p.pid == pid; });
+                    if (it != plist.end()) moved = (int)(it - plist.begin());
+                    else if (!goto_pid.empty()) prompt = "pid " + goto_pid + " not found";
+                }
+            }
+            else if (ch == 'q' || ch == 'Q') {
+                quit = true;
+                break;
+            }
+            else if (ch == 's' || ch == 'S') {
+                sort_key = (SortKey)((sort_key + 1) % NUM_SORT_KEYS);
+                sort_processes(plist, sort_key);
+                cursor.follow(plist);
+            }
+            else if (ch == 'g' || ch == 'G') {
+                goto_active = true;
+                goto_pid.clear();
+            }
+            else if (ch == 'e' || ch == 'E') {
+                show_events = !show_events;
+                event_scroll = 0;
+                relayout();
+            }
+            else if (ch == '[' && show_events) event_scroll = std::min(event_scroll + (event_rows - 2), events.size());
+            else if (ch == ']' && show_events) event_scroll -= std::min<size_t>(event_scroll, event_rows - 2);
+            else if (ch == 'l' || ch == 'L') {
+                show_leaks = !show_leaks;
+                relayout();
+            }
+            else if ((ch == 'n' || ch == 'N') && opt.emergency) prompt = "no NUMA sampling in emergency mode";
+            else if (ch == 'n' || ch == 'N') {
+                show_numa = !show_numa;
+                if (show_numa) {
+                    numa.update(cur_procs, 0, tick);
+                    since(numa_at);
+                }
+                relayout();
+            }
+            else if ((ch == 'c' || ch == 'C') && opt.emergency) prompt = "no CPU placement sampling in emergency mode";
+            else if (ch == 'c' || ch == 'C') {
+                show_placement = !show_placement;
+                if (show_placement) {
+                    placement.update(cur_procs, 0);
+                    since(placement_at);
+                }
+                relayout();
+            }
+            else if ((ch == 't' || ch == 'T') && opt.emergency) prompt = "no cgroup sampling in emergency mode";
+            else if (ch == 't' || ch == 'T') {
+                show_throttle = !show_throttle;
+                if (show_throttle) {
+                    throttle.update(0, tick);
+                    since(throttle_at);
+                }
+                relayout();
+            }
+            else if (ch == 'd' || ch == 'D') {
+                show_detail = !show_detail && !plist.empty();
+                if (show_detail) detail_proc = plist[cursor.sel];
+                relayout();
+            }
+            else if ((ch == 'w' || ch == 'W') && !plist.empty()) {
+                run_watch(*screen, {show_detail ? detail_proc.pid : plist[cursor.sel].pid}, opt.watch_hz);
+                screen->size(rows, cols);  // it may have been resized meanwhile
+                relayout();
+            }
+            else if (ch == KEY_DOWN) moved = cursor.sel + 1;
+            else if (ch == KEY_UP) moved = cursor.sel - 1;
+            else if (ch == KEY_NPAGE) {
+                cursor.top += proc_rows;
+                moved = cursor.sel + proc_rows;
+            }
+            else if (ch == KEY_PPAGE) {
+                cursor.top -= proc_rows;
+                moved = std::max(0, cursor.sel - proc_rows);
+            }
+            else if (ch == KEY_HOME) moved = 0;
+            else if (ch == KEY_END) moved = (int)plist.size() - 1;
+            if (moved >= 0) {
+                cursor.move_to(moved, plist);
+                if (show_detail && !plist.empty()) detail_proc = plist[cursor.sel];
+            }
+        }
+        if (quit) break;
+    }
+
+    connector.stop();
+    retention.close();
+    recorder.close();
+    tracer.close();
+    arrow.close();
+    screen->stop();
+    if (!opt.state_path.empty() && !StateCheckpoint::save(opt.state_path, prev_snap, prev_procs, history)) {
+        fprintf(stderr, "cannot write state to %s\n", opt.state_path.c_str());
+        return 1;
+    }
+    return 0;
+}